@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include "message_slot.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,6 +8,10 @@
 #include <stddef.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <poll.h>
 
 static char* DEV0 = "/dev/test0";
 static char* DEV1 = "/dev/test1";
@@ -25,6 +30,11 @@ void test11();
 void test12();
 void test13();
 void test14();
+void test15();
+void test16();
+void test17();
+void test18();
+void test19();
 void print_failure(int test_num);
 void print_success(int test_num);
 
@@ -45,6 +55,11 @@ int main(void)
 	test12();
 	test13();
 	test14();
+	test15();
+	test16();
+	test17();
+	test18();
+	test19();
 
 	printf("DONE!\n");
 
@@ -294,7 +309,8 @@ void test8()
         int device0_fd;
 	char msg[128];
 
-        device0_fd = open(DEV0, O_RDWR);
+        /* an empty channel only fails the read without blocking under O_NONBLOCK */
+        device0_fd = open(DEV0, O_RDWR | O_NONBLOCK);
         if (device0_fd < 0)
         { print_failure(8); exit(0); }
 
@@ -431,6 +447,285 @@ void test14()
 	print_success(14);
 }
 
+void test15()
+{
+	int device0_fd;
+	int bytes_read;
+	char msg[128];
+	struct msg_slot_xfer xfer;
+
+	device0_fd = open(DEV0, O_RDWR);
+	if (device0_fd < 0)
+	{ print_failure(15); exit(0); }
+
+	/* channel and message in one ioctl, the file itself gets no channel */
+	xfer.channel = 15; xfer.len = 5; xfer.buf = "first";
+	if (ioctl(device0_fd, IOCTL_MSG_SLOT_WRITE, &xfer) != 5)
+	{ print_failure(15); exit(0); }
+
+	xfer.channel = 16; xfer.len = 6; xfer.buf = "second";
+	if (ioctl(device0_fd, IOCTL_MSG_SLOT_WRITE, &xfer) != 6)
+	{ print_failure(15); exit(0); }
+
+	if (write(device0_fd, "abcd", 4) != -1 || errno != EINVAL)
+	{ print_failure(15); exit(0); }
+
+	xfer.channel = 15; xfer.len = 128; xfer.buf = msg;
+	bytes_read = ioctl(device0_fd, IOCTL_MSG_SLOT_READ, &xfer);
+	if (bytes_read != 5 || strncmp(msg, "first", 5))
+	{ print_failure(15); exit(0); }
+
+	xfer.channel = 16; xfer.len = 2;
+	if (ioctl(device0_fd, IOCTL_MSG_SLOT_READ, &xfer) != -1 || errno != ENOSPC)
+	{ print_failure(15); exit(0); }
+
+	xfer.channel = 0; xfer.len = 128;
+	if (ioctl(device0_fd, IOCTL_MSG_SLOT_READ, &xfer) != -1 || errno != EINVAL)
+	{ print_failure(15); exit(0); }
+
+	/* the same channel through the file */
+	if (ioctl(device0_fd, MSG_SLOT_CHANNEL, 16) < 0)
+	{ print_failure(15); exit(0); }
+
+	bytes_read = read(device0_fd, msg, 128);
+	if (bytes_read != 6 || strncmp(msg, "second", 6))
+	{ print_failure(15); exit(0); }
+
+	close(device0_fd);
+
+	print_success(15);
+}
+
+#define SCALE_PROBES 1000
+#define SCALE_CHANNELS 50000
+#define SCALE_BASE (1 << 24)
+#define SCALE_REPEATS 7
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* writes its own number to every stride-th channel from first on, returns the time taken */
+static double write_channels(int fd, unsigned int first, int count, int stride)
+{
+	struct msg_slot_xfer xfer;
+	char msg[16];
+	double start = now_sec();
+	int i;
+
+	for (i = 0; i < count; i++) {
+		xfer.channel = first + i * stride;
+		xfer.len = snprintf(msg, sizeof(msg), "%u", xfer.channel);
+		xfer.buf = msg;
+		if (ioctl(fd, IOCTL_MSG_SLOT_WRITE, &xfer) != (int)xfer.len)
+			return -1;
+	}
+	return now_sec() - start;
+}
+
+/* fastest of SCALE_REPEATS passes over the same channels, a pass that got preempted does not count */
+static double best_pass(int fd, unsigned int first, int count, int stride)
+{
+	double best = -1, t;
+	int i;
+
+	for (i = 0; i < SCALE_REPEATS; i++) {
+		t = write_channels(fd, first, count, stride);
+		if (t < 0)
+			return -1;
+		if (best < 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+void test16()
+{
+	int device1_fd;
+	int i;
+	double small, large;
+	char msg[128];
+	char expected[16];
+	struct msg_slot_xfer xfer;
+
+	device1_fd = open(DEV1, O_RDWR);
+	if (device1_fd < 0)
+	{ print_failure(16); exit(0); }
+
+	/* finding a channel must cost the same with 1000 or 50000 channels on the minor: the same number
+	 * of writes to existing channels, the second time spread over all of them */
+	if (write_channels(device1_fd, SCALE_BASE, SCALE_PROBES, 1) < 0)
+	{ print_failure(16); exit(0); }
+
+	small = best_pass(device1_fd, SCALE_BASE, SCALE_PROBES, 1);
+	if (small < 0)
+	{ print_failure(16); exit(0); }
+
+	if (write_channels(device1_fd, SCALE_BASE + SCALE_PROBES, SCALE_CHANNELS - SCALE_PROBES, 1) < 0)
+	{ print_failure(16); exit(0); }
+
+	large = best_pass(device1_fd, SCALE_BASE, SCALE_PROBES, SCALE_CHANNELS / SCALE_PROBES);
+	if (large < 0 || large > 4 * small + 0.005)
+	{ print_failure(16); exit(0); }
+
+	for (i = 0; i < SCALE_CHANNELS; i += 997) {
+		xfer.channel = SCALE_BASE + i;
+		xfer.len = 128;
+		xfer.buf = msg;
+		if (ioctl(device1_fd, IOCTL_MSG_SLOT_READ, &xfer) != snprintf(expected, sizeof(expected), "%u", SCALE_BASE + i) ||
+		    strncmp(msg, expected, strlen(expected)))
+		{ print_failure(16); exit(0); }
+	}
+
+	close(device1_fd);
+
+	print_success(16);
+}
+
+#define TORN_READS 200000
+
+void test17()
+{
+	int device0_fd;
+	int bytes_read;
+	int i, j;
+	pid_t writer;
+	char msg[128];
+	char a[128];
+	char b[64];
+
+	memset(a, 'a', sizeof(a));
+	memset(b, 'b', sizeof(b));
+
+	device0_fd = open(DEV0, O_RDWR);
+	if (device0_fd < 0)
+	{ print_failure(17); exit(0); }
+
+	if (ioctl(device0_fd, MSG_SLOT_CHANNEL, 1717) < 0)
+	{ print_failure(17); exit(0); }
+
+	if (write(device0_fd, a, sizeof(a)) != sizeof(a))
+	{ print_failure(17); exit(0); }
+
+	/* a second process overwrites the channel nonstop while this one reads it */
+	writer = fork();
+	if (writer < 0)
+	{ print_failure(17); exit(0); }
+	if (writer == 0) {
+		for (i = 0; ; i++) {
+			if ((i & 1 ? write(device0_fd, a, sizeof(a)) : write(device0_fd, b, sizeof(b))) < 0)
+				_exit(1);
+		}
+	}
+
+	for (i = 0; i < TORN_READS; i++) {
+		bytes_read = read(device0_fd, msg, 128);
+		if (bytes_read != sizeof(a) && bytes_read != sizeof(b))
+			break;
+		/* all of one message: 128 a's or 64 b's, never a mix */
+		for (j = 0; j < bytes_read && msg[j] == (bytes_read == sizeof(a) ? 'a' : 'b'); j++)
+			;
+		if (j != bytes_read)
+			break;
+	}
+
+	kill(writer, SIGKILL);
+	waitpid(writer, NULL, 0);
+	close(device0_fd);
+
+	if (i != TORN_READS)
+	{ print_failure(17); exit(0); }
+
+	print_success(17);
+}
+
+void test18()
+{
+	int device0_fd;
+	int bytes_read;
+	pid_t writer;
+	char msg[128];
+	struct timespec delay = {0, 200 * 1000 * 1000};
+	double start;
+
+	device0_fd = open(DEV0, O_RDWR);
+	if (device0_fd < 0)
+	{ print_failure(18); exit(0); }
+
+	/* a channel no one wrote to: the read sleeps until the write 200ms later */
+	if (ioctl(device0_fd, MSG_SLOT_CHANNEL, SCALE_BASE - getpid()) < 0)
+	{ print_failure(18); exit(0); }
+
+	writer = fork();
+	if (writer < 0)
+	{ print_failure(18); exit(0); }
+	if (writer == 0) {
+		nanosleep(&delay, NULL);
+		_exit(write(device0_fd, "wake", 4) == 4 ? 0 : 1);
+	}
+
+	start = now_sec();
+	bytes_read = read(device0_fd, msg, 128);
+	waitpid(writer, NULL, 0);
+	if (bytes_read != 4 || strncmp(msg, "wake", 4) || now_sec() - start < 0.1)
+	{ print_failure(18); exit(0); }
+
+	close(device0_fd);
+
+	print_success(18);
+}
+
+void test19()
+{
+	int reader_fd;
+	int writer_fd;
+	char msg[128];
+	struct pollfd pfd;
+
+	reader_fd = open(DEV1, O_RDONLY | O_NONBLOCK);
+	if (reader_fd < 0)
+	{ print_failure(19); exit(0); }
+
+	writer_fd = open(DEV1, O_RDWR);
+	if (writer_fd < 0)
+	{ print_failure(19); exit(0); }
+
+	if (ioctl(reader_fd, MSG_SLOT_CHANNEL, 1919) < 0 || ioctl(writer_fd, MSG_SLOT_CHANNEL, 1919) < 0)
+	{ print_failure(19); exit(0); }
+
+	if (write(writer_fd, "one", 3) != 3)
+	{ print_failure(19); exit(0); }
+
+	pfd.fd = reader_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 1000) != 1 || !(pfd.revents & POLLIN))
+	{ print_failure(19); exit(0); }
+
+	if (read(reader_fd, msg, 128) != 3 || strncmp(msg, "one", 3))
+	{ print_failure(19); exit(0); }
+
+	/* read once, the kept message does not make the file readable again */
+	if (poll(&pfd, 1, 0) != 0)
+	{ print_failure(19); exit(0); }
+
+	if (write(writer_fd, "two", 3) != 3)
+	{ print_failure(19); exit(0); }
+
+	if (poll(&pfd, 1, 1000) != 1 || !(pfd.revents & POLLIN))
+	{ print_failure(19); exit(0); }
+
+	if (read(reader_fd, msg, 128) != 3 || strncmp(msg, "two", 3))
+	{ print_failure(19); exit(0); }
+
+	close(reader_fd);
+	close(writer_fd);
+
+	print_success(19);
+}
+
 void print_success(int test_num)
 {
 	printf("TEST %d: Success\n", test_num);
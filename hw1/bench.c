@@ -0,0 +1,234 @@
+//gcc -O2 -Wall -std=c11 bench.c pt.c -o bench -lm//
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+#include <sys/mman.h>
+
+#include "os.h"
+
+/*
+ * Benchmark driver for pt.c.
+ * Usage: ./bench [ops] [seed] > results.csv
+ * Every workload runs on a fresh page table, first untimed (warm-up) and then
+ * timed, so page faults of the simulated physical memory are not measured.
+ * Output is one CSV row per (workload, operation).
+ */
+
+/* 2^20 pages, the same physical memory size os.c simulates */
+#define NPAGES (1024 * 1024)
+#define PAGE_SIZE 4096
+#define VPN_BITS 45
+#define DEFAULT_OPS 100000
+#define DEFAULT_SEED 0x5eed
+#define ZIPF_HOT_SET 4096
+#define ZIPF_SKEW 0.99
+#define CHURN_WINDOW 8192
+
+/* one contiguous arena instead of a mmap per frame, so frames can be reset between runs */
+static char *arena;
+static uint64_t nalloc;
+
+uint64_t alloc_page_frame(void)
+{
+	uint64_t ppn;
+
+	if (nalloc == NPAGES)
+		errx(1, "out of physical memory");
+
+	ppn = nalloc;
+	nalloc++;
+	return ppn + 0xbaaaaaad;
+}
+
+void *phys_to_virt(uint64_t phys_addr)
+{
+	uint64_t ppn = (phys_addr >> 12) - 0xbaaaaaad;
+	uint64_t off = phys_addr & 0xfff;
+
+	if (ppn < NPAGES)
+		return arena + ppn * PAGE_SIZE + off;
+	return NULL;
+}
+
+static void reset_frames(void)
+{
+	// zero instead of unmapping: frames stay resident, so the timed pass takes no page faults
+	memset(arena, 0, nalloc * PAGE_SIZE);
+	nalloc = 0;
+}
+
+// ===================== workload generation =====================
+
+/* xorshift64* - fixed seed gives the same vpn sequence on every machine */
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void rng_seed(uint64_t seed)
+{
+	rng_state = seed ? seed : 1;
+}
+
+static uint64_t random_vpn(void)
+{
+	return rng_next() & ((1ULL << VPN_BITS) - 1);
+}
+
+static void gen_sequential(uint64_t *vpns, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		vpns[i] = i;
+}
+
+static void gen_strided(uint64_t *vpns, size_t n)
+{
+	// one leaf table per vpn: every update walks into a freshly allocated leaf
+	for (size_t i = 0; i < n; i++)
+		vpns[i] = (i * 512) & ((1ULL << VPN_BITS) - 1);
+}
+
+static void gen_random(uint64_t *vpns, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		vpns[i] = random_vpn();
+}
+
+static void gen_zipf(uint64_t *vpns, size_t n)
+{
+	static uint64_t hot[ZIPF_HOT_SET];
+	static double cdf[ZIPF_HOT_SET];
+	double sum = 0;
+
+	for (size_t i = 0; i < ZIPF_HOT_SET; i++) {
+		hot[i] = random_vpn();
+		sum += 1.0 / pow((double)(i + 1), ZIPF_SKEW);
+		cdf[i] = sum;
+	}
+	for (size_t i = 0; i < n; i++) {
+		double u = (double)(rng_next() >> 11) / (double)(1ULL << 53) * sum;
+		size_t lo = 0, hi = ZIPF_HOT_SET - 1;
+		// first rank whose cumulative weight reaches u
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		vpns[i] = hot[lo];
+	}
+}
+
+static void gen_churn(uint64_t *vpns, size_t n)
+{
+	static uint64_t window[CHURN_WINDOW];
+
+	for (size_t i = 0; i < CHURN_WINDOW; i++)
+		window[i] = random_vpn();
+	for (size_t i = 0; i < n; i++)
+		vpns[i] = window[rng_next() % CHURN_WINDOW];
+}
+
+// ===================== measurement =====================
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static volatile uint64_t sink;
+
+/* churn alternates mapping and unmapping inside a fixed window of vpns */
+static void run_updates(uint64_t pt, const uint64_t *vpns, size_t n, int churn)
+{
+	for (size_t i = 0; i < n; i++) {
+		uint64_t ppn = (churn && (i & 1)) ? NO_MAPPING : (vpns[i] & 0xfffffff);
+		page_table_update(pt, vpns[i], ppn);
+	}
+}
+
+static void run_queries(uint64_t pt, const uint64_t *vpns, size_t n)
+{
+	uint64_t acc = 0;
+	for (size_t i = 0; i < n; i++)
+		acc += page_table_query(pt, vpns[i]);
+	sink = acc;
+}
+
+static void report(const char *workload, const char *op, size_t n, uint64_t seed,
+				   double ns, uint64_t pages)
+{
+	printf("%s,%s,%zu,%#lx,%.2f,%lu,%lu\n", workload, op, n, (unsigned long)seed, ns / n,
+		   (unsigned long)pages, (unsigned long)(pages * PAGE_SIZE));
+}
+
+static void bench_workload(const char *name, void (*gen)(uint64_t *, size_t),
+						   uint64_t *vpns, size_t n, uint64_t seed, int churn)
+{
+	uint64_t pt;
+	double start;
+
+	rng_seed(seed);
+	gen(vpns, n);
+
+	// warm-up pass: touches every frame the timed pass will use
+	reset_frames();
+	pt = alloc_page_frame();
+	run_updates(pt, vpns, n, churn);
+	run_queries(pt, vpns, n);
+
+	reset_frames();
+	pt = alloc_page_frame();
+	start = now_ns();
+	run_updates(pt, vpns, n, churn);
+	report(name, "update", n, seed, now_ns() - start, nalloc);
+
+	start = now_ns();
+	run_queries(pt, vpns, n);
+	report(name, "query", n, seed, now_ns() - start, nalloc);
+}
+
+int main(int argc, char **argv)
+{
+	size_t ops = argc > 1 ? strtoull(argv[1], NULL, 0) : DEFAULT_OPS;
+	uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 0) : DEFAULT_SEED;
+	uint64_t *vpns;
+
+	if (ops == 0)
+		errx(1, "usage: %s [ops] [seed]", argv[0]);
+	/* a random vpn can cost 4 new frames, keep the worst case inside the arena */
+	if (ops > (NPAGES - 1) / 4)
+		errx(1, "ops must be at most %d", (NPAGES - 1) / 4);
+
+	arena = mmap(NULL, (size_t)NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (arena == MAP_FAILED)
+		err(1, "mmap failed");
+	vpns = malloc(ops * sizeof(*vpns));
+	if (vpns == NULL)
+		err(1, "malloc failed");
+
+	printf("workload,op,ops,seed,ns_per_op,table_pages,table_bytes\n");
+	bench_workload("sequential", gen_sequential, vpns, ops, seed, 0);
+	bench_workload("strided", gen_strided, vpns, ops, seed, 0);
+	bench_workload("random", gen_random, vpns, ops, seed, 0);
+	bench_workload("zipf", gen_zipf, vpns, ops, seed, 0);
+	bench_workload("churn", gen_churn, vpns, ops, seed, 1);
+
+	free(vpns);
+	munmap(arena, (size_t)NPAGES * PAGE_SIZE);
+	return 0;
+}
@@ -0,0 +1,131 @@
+//gcc -O2 -Wall bench_launch.c myshell.c -o bench_launch//
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Launch latency of process_arglist at several shell RSS sizes.
+ * Usage: ./bench_launch [iterations] [rss_mb ...] > results.csv
+ * The RSS is inflated with touched anonymous memory, then this binary is run as
+ * a probe command through the fork, posix_spawn and zygote launch paths
+ * (MYSHELL_LAUNCH). The probe stores the monotonic time it started at, which
+ * gives the start latency (launch request to running program); the round trip
+ * is the whole process_arglist call, reaping included.
+ */
+
+#define DEFAULT_ITERATIONS 500
+#define MB (1024 * 1024)
+
+int process_arglist(int, char **);
+int prepare(void);
+int finalize(void);
+
+static double now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// probe side: ./bench_launch --probe file
+static int probe(const char *path)
+{
+	double start = now_us();
+	int fd = open(path, O_WRONLY);
+
+	if (fd == -1 || pwrite(fd, &start, sizeof(start), 0) != sizeof(start))
+		return 1;
+	close(fd);
+	return 0;
+}
+
+static void time_launches(const char *mode, int iterations, char *self, char *stamp_path,
+						  double *start_us, double *roundtrip_us)
+{
+	char *arglist[] = {self, "--probe", stamp_path, NULL};
+	int fd = open(stamp_path, O_RDONLY);
+	double started, total_start = 0, total_roundtrip = 0;
+
+	if (fd == -1)
+		err(1, "open %s", stamp_path);
+	if (setenv("MYSHELL_LAUNCH", mode, 1) != 0)
+		err(1, "setenv failed");
+	// warm-up: first launch pays for loading the spawn machinery
+	process_arglist(3, arglist);
+
+	for (int i = 0; i < iterations; i++)
+	{
+		double before = now_us();
+		if (!process_arglist(3, arglist))
+			errx(1, "launch failed in %s mode", mode);
+		total_roundtrip += now_us() - before;
+		if (pread(fd, &started, sizeof(started), 0) != sizeof(started))
+			err(1, "reading probe time failed");
+		total_start += started - before;
+	}
+	close(fd);
+	*start_us = total_start / iterations;
+	*roundtrip_us = total_roundtrip / iterations;
+}
+
+int main(int argc, char **argv)
+{
+	static const long default_sizes[] = {0, 64, 256, 1024};
+	static const char *modes[] = {"fork", "spawn", "zygote"};
+	char self[4096];
+	char stamp_path[] = "/tmp/bench_launch.XXXXXX";
+	int iterations, nsizes;
+
+	if (argc == 3 && strcmp(argv[1], "--probe") == 0)
+		return probe(argv[2]);
+
+	iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+	nsizes = argc > 2 ? argc - 2 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+	if (iterations <= 0)
+		errx(1, "usage: %s [iterations] [rss_mb ...]", argv[0]);
+	ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len == -1)
+		err(1, "readlink failed");
+	self[len] = '\0';
+	int stamp_fd = mkstemp(stamp_path);
+	if (stamp_fd == -1)
+		err(1, "mkstemp failed");
+	close(stamp_fd);
+
+	// the zygote master is forked by prepare, before the RSS grows
+	setenv("MYSHELL_LAUNCH", "zygote", 1);
+	if (prepare() != 0)
+		exit(1);
+
+	printf("mode,rss_mb,iterations,us_start,us_roundtrip\n");
+	for (int s = 0; s < nsizes; s++)
+	{
+		long rss_mb = argc > 2 ? atol(argv[s + 2]) : default_sizes[s];
+		char *ballast = NULL;
+
+		if (rss_mb > 0)
+		{
+			ballast = mmap(NULL, rss_mb * MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (ballast == MAP_FAILED)
+				err(1, "mmap failed");
+			// touch every page so fork has real page tables to copy
+			memset(ballast, 1, rss_mb * MB);
+		}
+		for (int m = 0; m < 3; m++)
+		{
+			double start_us, roundtrip_us;
+			time_launches(modes[m], iterations, self, stamp_path, &start_us, &roundtrip_us);
+			printf("%s,%ld,%d,%.2f,%.2f\n", modes[m], rss_mb, iterations, start_us, roundtrip_us);
+		}
+		if (ballast != NULL)
+			munmap(ballast, rss_mb * MB);
+	}
+	unlink(stamp_path);
+	return finalize();
+}
@@ -0,0 +1,212 @@
+//gcc -O2 -Wall bench_shell.c myshell.c -o bench_shell//
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Workloads run through the real shell.c loop, compiled in below with its main renamed and
+ * every process_arglist call timed.
+ * Usage: ./bench_shell [commands] [file_mb] > results.csv
+ * Workloads: back-to-back /bin/true, cat pipelines of 1, 2, 4 and 8 stages over a sparse
+ * file_mb file, bursts of background jobs drained by "wait", and a mix of redirections.
+ * MYSHELL_LAUNCH and PIPE_SIZE are honoured, so launch paths can be compared run against run.
+ * One CSV row per workload; latency is the time a process_arglist call takes (for "&" lines
+ * that is the launch alone), mb_per_s is only set for pipelines.
+ */
+
+#define main shell_main
+#define process_arglist timed_process_arglist
+#include "shell.c"
+#undef main
+#undef process_arglist
+
+#define DEFAULT_COMMANDS 2000
+#define DEFAULT_FILE_MB 2048
+#define MB (1024 * 1024)
+
+int process_arglist(int, char **);
+
+static double *latencies;
+static size_t nlatencies, latencies_size;
+
+static double now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// every line shell.c runs comes through here
+int timed_process_arglist(int count, char **arglist)
+{
+	// "wait" drains the burst, it is not a launch
+	int record = strcmp(arglist[0], "wait") != 0;
+	double start = now_us();
+	int ret = process_arglist(count, arglist);
+
+	if (record)
+	{
+		if (nlatencies == latencies_size)
+		{
+			latencies_size = latencies_size == 0 ? 4096 : latencies_size * 2;
+			latencies = realloc(latencies, latencies_size * sizeof(*latencies));
+			if (latencies == NULL)
+				err(1, "realloc failed");
+		}
+		latencies[nlatencies++] = now_us() - start;
+	}
+	return ret;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double p)
+{
+	size_t i = (size_t)(p * (nlatencies - 1) + 0.5);
+	return nlatencies > 0 ? latencies[i] : 0;
+}
+
+// runs script through shell_main with the shell's stdout discarded, then prints the row
+static void run_script(const char *workload, const char *script, double bytes)
+{
+	char *argv[] = {"shell", (char *)script, NULL};
+	int saved_out, null_fd;
+	double start, secs;
+
+	nlatencies = 0;
+	fflush(stdout);
+	saved_out = dup(1);
+	null_fd = open("/dev/null", O_WRONLY);
+	if (saved_out == -1 || null_fd == -1 || dup2(null_fd, 1) == -1)
+		err(1, "redirecting stdout failed");
+	close(null_fd);
+
+	// shell.c parses its options with getopt, start it over for every run
+	optind = 1;
+	start = now_us();
+	if (shell_main(2, argv) != 0)
+		errx(1, "%s: shell failed", workload);
+	secs = (now_us() - start) / 1e6;
+
+	fflush(stdout);
+	dup2(saved_out, 1);
+	close(saved_out);
+	qsort(latencies, nlatencies, sizeof(*latencies), cmp_double);
+	printf("%s,%s,%zu,%.3f,%.1f,%.1f,%.1f,", workload, getenv("MYSHELL_LAUNCH") ? getenv("MYSHELL_LAUNCH") : "spawn",
+		   nlatencies, secs, nlatencies / secs, percentile(0.5), percentile(0.99));
+	if (bytes > 0)
+		printf("%.1f\n", bytes / secs / 1e6);
+	else
+		printf("\n");
+}
+
+static FILE *open_script(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (f == NULL)
+		err(1, "%s", path);
+	return f;
+}
+
+int main(int argc, char **argv)
+{
+	static const int stage_counts[] = {1, 2, 4, 8};
+	long commands = argc > 1 ? atol(argv[1]) : DEFAULT_COMMANDS;
+	long file_mb = argc > 2 ? atol(argv[2]) : DEFAULT_FILE_MB;
+	char dir[] = "/tmp/bench_shell.XXXXXX";
+	char script[4096], big[4096], small[4096], out[4096], copy[4096];
+	FILE *f;
+	int fd;
+
+	if (commands <= 0 || file_mb <= 0)
+		errx(1, "usage: %s [commands] [file_mb]", argv[0]);
+	if (mkdtemp(dir) == NULL)
+		err(1, "mkdtemp failed");
+	snprintf(script, sizeof(script), "%s/script", dir);
+	snprintf(big, sizeof(big), "%s/big", dir);
+	snprintf(small, sizeof(small), "%s/small", dir);
+	snprintf(out, sizeof(out), "%s/out", dir);
+	snprintf(copy, sizeof(copy), "%s/copy", dir);
+
+	// sparse: the pipelines read zeros from the page cache, the disk is not what is measured
+	fd = open(big, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || ftruncate(fd, file_mb * MB) == -1)
+		err(1, "%s", big);
+	close(fd);
+	f = open_script(small);
+	for (int i = 0; i < 64; i++)
+		fprintf(f, "line %d of the redirect input\n", 64 - i);
+	fclose(f);
+
+	printf("workload,launch,commands,seconds,commands_per_sec,p50_us,p99_us,mb_per_s\n");
+
+	f = open_script(script);
+	for (long i = 0; i < commands; i++)
+		fprintf(f, "/bin/true\n");
+	fclose(f);
+	run_script("true", script, 0);
+
+	for (size_t s = 0; s < sizeof(stage_counts) / sizeof(stage_counts[0]); s++)
+	{
+		char name[32];
+		f = open_script(script);
+		fprintf(f, "cat %s", big);
+		for (int i = 1; i < stage_counts[s]; i++)
+			fprintf(f, " | cat");
+		fprintf(f, " | wc -c\n");
+		fclose(f);
+		snprintf(name, sizeof(name), "pipeline_%d", stage_counts[s]);
+		run_script(name, script, (double)file_mb * MB);
+	}
+
+	// bursts of at most 1000 jobs, each drained before the next starts
+	f = open_script(script);
+	for (long i = 0; i < commands; i++)
+	{
+		fprintf(f, "/bin/true &\n");
+		if (i % 1000 == 999 || i == commands - 1)
+			fprintf(f, "wait\n");
+	}
+	fclose(f);
+	run_script("background", script, 0);
+
+	f = open_script(script);
+	for (long i = 0; i < commands; i++)
+	{
+		switch (i % 4)
+		{
+		case 0:
+			fprintf(f, "/bin/echo line %ld >> %s\n", i, out);
+			break;
+		case 1:
+			fprintf(f, "tr a-z A-Z <<< \"here string %ld\" >> %s\n", i, out);
+			break;
+		case 2:
+			fprintf(f, "sort < %s | uniq >> %s\n", small, out);
+			break;
+		default:
+			fprintf(f, "cat %s >> %s\n", small, copy);
+			break;
+		}
+	}
+	fclose(f);
+	run_script("redirect", script, 0);
+
+	unlink(script);
+	unlink(big);
+	unlink(small);
+	unlink(out);
+	unlink(copy);
+	rmdir(dir);
+	free(latencies);
+	return 0;
+}
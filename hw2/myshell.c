@@ -5,301 +5,3965 @@
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <spawn.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sched.h>
+#include <limits.h>
+#include <stdint.h>
+
+// status of the last command the way a shell reports it: the exit code, 128+N after signal N,
+// 127 when the command was not found; "&&" and "||" test it and "$?" expands to it
+static int last_status = 0;
+
+// every operator of the shell. The tokenizer hands out these very strings for the unquoted ones,
+// so words are matched by address: a quoted '|' or '$?' is the same text but plain data
+static char operators[][4] = {";", "&", "&&", "||", "|", "|&", "|>", "<", ">>", "<<", "<<<", "<(", "{", "}", "$?"};
+#define NOPERATORS (sizeof(operators) / sizeof(operators[0]))
+
+// everything needed to start one external command
+typedef struct launch
+{
+	char **argv;
+	int in_fd;		// becomes stdin of the child, 0 to inherit
+	int out_fd;		// becomes stdout of the child, 1 to inherit
+	int close_fd;	// pipe end only the parent needs, -1 if none
+	char *in_path;	// "<" target, opened by a forked child or by the shell for spawn and zygote
+	char *out_path; // ">>" target, opened the same way
+	int background; // keep SIGINT ignored instead of restoring the default
+	char *path;		// resolved by the command hash, NULL means search PATH at exec time
+	const struct sched_ctl *sched; // applied in the child before exec, NULL for none
+} launch_t;
+
+// CPUS, NICE, SCHED and IOPRIO of a command, from "NAME=value cmd" prefixes or the environment
+typedef struct sched_ctl
+{
+	int has_cpus;
+	cpu_set_t cpus;
+	int has_nice;
+	int nice;
+	int policy;	  // SCHED_*, -1 to inherit
+	int priority; // static priority for fifo and rr
+	int ioprio;	  // ioprio_set value, -1 to inherit
+} sched_ctl_t;
+
+#define SCHED_VARS 4
+static const char *sched_vars[SCHED_VARS] = {"CPUS", "NICE", "SCHED", "IOPRIO"};
+// values given as prefixes of the line being run, they override the environment
+static char *sched_prefix[SCHED_VARS];
+// BG_CPUS round robin: where the search for the next background CPU starts
+static int bg_next_cpu = 0;
+
+// commands run inside the shell process, each returns 1 to continue and 0 to exit the shell
+typedef struct builtin
+{
+	const char *name;
+	int (*run)(int, char **);
+} builtin_t;
+
+// bash style "hash": command name -> absolute path, so launches skip the PATH scan
+#define HASH_BUCKETS 64
+
+typedef struct hash_entry
+{
+	char *name;
+	char *path;
+	unsigned long hits;
+	struct hash_entry *next;
+} hash_entry;
+
+static hash_entry *command_hash[HASH_BUCKETS];
+// PATH the cached entries were resolved against
+static char *hashed_path_env = NULL;
+
+// background job, kept after it exits until "jobs" or "wait" has reported it
+typedef struct job
+{
+	int id;
+	pid_t pid;
+	int pidfd;	 // -1 when exits are noticed through the SIGCHLD signalfd
+	int running;
+	int status;	 // wait status, valid once running is 0
+	int cpu;	 // CPU picked from BG_CPUS, -1 if none
+	int throttled; // holds one of the BG_MAX slots until it is reaped
+	char *command;
+} job_t;
+
+// epoll over one pidfd per job, or over a single signalfd when pidfd_open is unavailable
+static int job_epoll = -1;
+static int child_signalfd = -1;
+static job_t *job_table = NULL;
+static int njobs = 0, jobs_capacity = 0, next_job_id = 1;
+// finished jobs nobody listed yet; past MAX_FINISHED_JOBS the oldest are dropped unreported,
+// so "cmd &" lines without a "jobs" or "wait" keep the table bounded
+#define MAX_FINISHED_JOBS 1024
+static int finished_jobs = 0;
+
+// a "cmd &" held back by BG_MAX, BG_MAX_LOAD or BG_MIN_MEM, started in arrival order
+typedef struct queued_job
+{
+	char **argv;			  // argv and its strings in one allocation
+	char *prefix[SCHED_VARS]; // CPUS=... values given on the line, copied
+	double queued_at;		  // trace_now() clock
+	struct queued_job *next;
+} queued_job_t;
+
+static queued_job_t *queue_head = NULL, *queue_tail = NULL;
+static int queue_length = 0;
+static int bg_running = 0; // running jobs with throttled set
+static unsigned long queue_started = 0;
+static double queue_wait_total = 0, queue_wait_max = 0;
+
+// resource usage of one reaped foreground process (a command or a pipeline stage)
+#define STATS_HISTORY 256
+
+typedef struct proc_stats
+{
+	char command[64];
+	pid_t pid;
+	int status;
+	double wall; // seconds from launch to reap, monotonic clock
+	double user;
+	double sys;
+	long maxrss; // KiB
+	long nvcsw;
+	long nivcsw;
+} proc_stats;
+
+// ring of the most recent records, stats_total counts every record ever made
+static proc_stats stats_history[STATS_HISTORY];
+static unsigned long stats_total = 0;
+
+// zygote launch mode: a master forked once keeps ZYGOTE_POOL helpers ready, each waiting on its own
+// socket for argv, environment and fds. Helpers are created with CLONE_PARENT, so they are children
+// of the shell and are waited for like any other command.
+#define ZYGOTE_POOL 4
+#define ZYGOTE_MSG_MAX (128 * 1024)
+
+typedef struct zygote_request
+{
+	int background;
+	int has_path; // the first string is the resolved path
+	int argc;
+	int envc;
+	// followed by the NUL terminated strings, sent with stdin, stdout and cwd as SCM_RIGHTS
+} zygote_request;
+
+// the master's answer to a request, or to the shell shutting its end down
+typedef struct zygote_reply
+{
+	pid_t pid;					// helper that took the request, negative if none
+	int ndead;
+	pid_t dead[ZYGOTE_POOL];	// helpers that exited without a request, the shell is their parent and reaps them
+} zygote_reply;
+
+static int zygote_ctl = -1; // shell end of the socket to the master
+static pid_t zygote_master_pid = -1;
+
+// "coproc NAME cmd": cmd runs next to the shell for as long as the script needs it, its stdin and
+// stdout are pipes owned by the shell that cowrite and coread talk through
+#define MAX_COPROCS 16
+#define COPROC_BUFFER 4096
+
+typedef struct coproc
+{
+	char *name; // NULL for a free slot
+	pid_t pid;
+	int to_fd;	 // write end of the stdin of cmd, -1 after "coclose -w"
+	int from_fd; // read end of the stdout of cmd
+	// replies read ahead of the line coread returns
+	char buf[COPROC_BUFFER];
+	size_t start, len;
+} coproc_t;
+
+static coproc_t coprocs[MAX_COPROCS];
+// set in the child of fork_builtin, whose read-ahead would be lost to the shell
+static int in_forked_builtin = 0;
+
+// "<(cmd)" words per line, each becomes a /dev/fd/N path to the read end of a pipe fed by cmd
+#define MAX_SUBSTITUTIONS 8
+
+// read ends currently inherited by launched commands, which the zygote helpers cannot see
+static int open_substitutions = 0;
+
+// bytes asked of one copy_file_range or sendfile call when cat copies in the shell, a source is
+// copied chunk by chunk until its end
+#define COPY_CHUNK (1 << 30)
+
+// MYSHELL_TRACE=file: launch, exec, first byte through a pipe, exit and reap of every process are
+// recorded into a ring shared with the children, and finalize writes it out as Chrome trace-event
+// JSON (chrome://tracing, ui.perfetto.dev). "%p" in the name becomes the pid of the shell.
+// With tracing off every trace point is a single test of trace_ring.
+#define TRACE_RING 65536
+
+enum trace_type
+{
+	TRACE_SPAN,		  // work done by the shell itself (lookup, launch, wait), from start to now
+	TRACE_START,	  // a process exists, start is when its launch began
+	TRACE_EXEC,		  // the process is about to run its program
+	TRACE_FIRST_BYTE, // first data in the pipe the process writes to, arg is the pipe index
+	TRACE_EXIT,		  // the shell saw the process exit at start, arg is the wait status
+	TRACE_REAP,		  // the process was waited for
+};
+
+typedef struct trace_event
+{
+	double ts; // microseconds, monotonic clock
+	double dur;
+	pid_t pid;
+	int type;
+	int arg;
+	char name[52];
+} trace_event_t;
+
+typedef struct trace_buffer
+{
+	unsigned long head; // events ever recorded, claimed atomically by every process
+	trace_event_t events[TRACE_RING];
+} trace_buffer_t;
+
+// what perform_pipe sends the watcher along with the read end of pipe index
+typedef struct trace_pipe_msg
+{
+	int index;
+	pid_t writer;
+} trace_pipe_msg;
+
+static trace_buffer_t *trace_ring = NULL;
+static char trace_path[4096];
+// only the process that started the ring writes it out, batch workers inherit it
+static pid_t trace_owner = 0;
+
+#define TRACE(...)                          \
+	do                                      \
+	{                                       \
+		if (trace_ring != NULL)             \
+		{                                   \
+			trace_record(__VA_ARGS__);      \
+		}                                   \
+	} while (0)
 
 int perform_input_redirection(char **, int);
 int perform_output_riderection(char **, int);
+int here_document(char *, int);
+int perform_here_redirection(char **, int);
+int perform_substitution(int, char **);
+unsigned int hash_name(const char *);
+void hash_clear(void);
+char *search_path(const char *);
+hash_entry *hash_find(const char *);
+char *hash_lookup(const char *);
+void hash_forget(const char *);
+int builtin_hash(int, char **);
+int builtin_cd(int, char **);
+int builtin_exit(int, char **);
+int builtin_echo(int, char **);
+int builtin_true(int, char **);
+int builtin_false(int, char **);
+int builtin_pwd(int, char **);
+int builtin_export(int, char **);
+int builtin_jobs(int, char **);
+int builtin_stats(int, char **);
+void record_stats(char **, pid_t, int, struct timespec *, struct rusage *);
+void print_stats(FILE *, unsigned long, unsigned long);
+int time_command(int, char **);
+coproc_t *find_coproc(const char *);
+void coproc_close(coproc_t *);
+int builtin_coproc(int, char **);
+int builtin_cowrite(int, char **);
+int builtin_coread(int, char **);
+int builtin_coclose(int, char **);
+int builtin_wait(int, char **);
+char *join_args(char **);
+int job_add(pid_t, char **);
+void job_reaped(job_t *, int, double);
+void reap_jobs(int);
+void job_remove(int);
+int job_index(int);
+void job_drop_finished(int);
+void describe_status(int, char *, size_t);
+char **copy_args(char **);
+double mem_available_mb(void);
+const char *admission_block(void);
+int queue_job(char **);
+void start_queued(void);
+void print_queue(void);
+int start_background(char **);
+const builtin_t *find_builtin(const char *);
+int run_builtin(const builtin_t *, launch_t *);
+pid_t fork_builtin(const builtin_t *, launch_t *);
+int run_foreground(launch_t *);
+void setup_child(launch_t *);
+void exec_stage(launch_t *);
+pid_t fork_command(launch_t *);
+pid_t spawn_command(launch_t *);
+int send_with_fds(int, void *, size_t, int *, int);
+ssize_t recv_with_fds(int, void *, size_t, int *, int);
+void zygote_helper(int, char *);
+pid_t zygote_new_helper(int *);
+void close_other_fds(int);
+void zygote_prune(int *, pid_t *, int *, zygote_reply *);
+void zygote_master(int);
+pid_t zygote_collect(int);
+int zygote_start(void);
+void zygote_stop(void);
+pid_t zygote_command(launch_t *);
+double trace_now(void);
+void trace_record(int, pid_t, double, int, const char *, char **);
+int trace_start(void);
+void trace_json_string(FILE *, const char *);
+void trace_dump(void);
+pid_t trace_pipe_watcher(int *);
+int sched_var(const char *);
+int parse_cpu_list(const char *, cpu_set_t *);
+int resolve_sched(sched_ctl_t *);
+void apply_sched(const sched_ctl_t *);
+int pick_background_cpu(const cpu_set_t *);
+int perform_sched_prefix(int, char **);
+pid_t launch_command(launch_t *);
+int wait_child(pid_t, char **, struct timespec *);
+long pipe_size(void);
+int make_pipe(int[2]);
+pid_t fork_bridge(int, int, int, char *, char *);
 int perform_pipe(char **, int);
+int write_all(int, const char *, size_t);
+pid_t fork_tee_bridge(int, int *, int);
+int perform_fanout(char **, int);
+int perform_file_copy(int, char **);
 int background(char **, int);
 int perform_non_background(char **);
+int exit_code(int);
+int list_separator(const char *);
+int is_pipe_op(const char *);
+int group_end(char **, int, int);
+int run_list(char **, int, int, int);
+int perform_list(int, char **);
 int process_arglist(int, char **);
-void sigchld_handler(int);
 int prepare(void);
 int finalize(void);
+int prepare_batch(void);
+int finalize_batch(void);
+int shell_status(void);
+char *shell_operator(const char *);
+int is_op(const char *, const char *);
 
-int perform_input_redirection(char **arglist, int redirect_index)
+static const builtin_t builtins[] = {
+	{"cd", builtin_cd},
+	{"exit", builtin_exit},
+	{"echo", builtin_echo},
+	{"true", builtin_true},
+	{"false", builtin_false},
+	{"pwd", builtin_pwd},
+	{"export", builtin_export},
+	{"hash", builtin_hash},
+	{"jobs", builtin_jobs},
+	{"wait", builtin_wait},
+	{"stats", builtin_stats},
+	{"coproc", builtin_coproc},
+	{"cowrite", builtin_cowrite},
+	{"coread", builtin_coread},
+	{"coclose", builtin_coclose},
+};
+
+// the operators[] entry spelled word, NULL if word is no operator
+char *shell_operator(const char *word)
 {
-	pid_t pid = fork();
-	if (pid < 0)
+	for (size_t i = 0; i < NOPERATORS; i++)
 	{
-		fprintf(stderr, "Fork error %s\n", strerror((errno)));
-		return 0;
+		if (strcmp(word, operators[i]) == 0)
+		{
+			return operators[i];
+		}
 	}
-	if (pid == 0)
+	return NULL;
+}
+// whether word is the operator op as the tokenizer produced it, not text that only reads the same
+int is_op(const char *word, const char *op)
+{
+	return (uintptr_t)word - (uintptr_t)operators < sizeof(operators) && strcmp(word, op) == 0;
+}
+unsigned int hash_name(const char *name)
+{
+	unsigned int h = 5381;
+	while (*name != '\0')
 	{
-		// child process
-		if (signal(SIGINT, SIG_DFL) == SIG_ERR)
+		h = h * 33 + (unsigned char)*name++;
+	}
+	return h % HASH_BUCKETS;
+}
+void hash_clear(void)
+{
+	for (int i = 0; i < HASH_BUCKETS; i++)
+	{
+		while (command_hash[i] != NULL)
 		{
-			// child should terminate upon SIGINT
-			fprintf(stderr, "Child signal configuration error %s\n", strerror((errno)));
-			exit(1);
+			hash_entry *next = command_hash[i]->next;
+			free(command_hash[i]->name);
+			free(command_hash[i]->path);
+			free(command_hash[i]);
+			command_hash[i] = next;
+		}
+	}
+	free(hashed_path_env);
+	hashed_path_env = NULL;
+}
+// the same scan execvp does, returns a malloced path or NULL if no executable was found
+char *search_path(const char *name)
+{
+	const char *path_env = getenv("PATH");
+	char *candidate;
+	struct stat st;
+
+	if (path_env == NULL)
+	{
+		path_env = "/bin:/usr/bin";
+	}
+	// "./" for an empty element is one byte more than the "/" of any other
+	candidate = malloc(strlen(path_env) + strlen(name) + 3);
+	if (candidate == NULL)
+	{
+		return NULL;
+	}
+	while (1)
+	{
+		const char *end = strchrnul(path_env, ':');
+		int len = end - path_env;
+		// empty PATH element means the current directory
+		if (len == 0)
+		{
+			sprintf(candidate, "./%s", name);
+		}
+		else
+		{
+			sprintf(candidate, "%.*s/%s", len, path_env, name);
+		}
+		if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0)
+		{
+			return candidate;
+		}
+		if (*end == '\0')
+		{
+			break;
+		}
+		path_env = end + 1;
+	}
+	free(candidate);
+	return NULL;
+}
+hash_entry *hash_find(const char *name)
+{
+	char *path_env = getenv("PATH");
+
+	// every entry was resolved against the old PATH, drop them all when it changes
+	if (hashed_path_env != NULL && strcmp(path_env != NULL ? path_env : "", hashed_path_env) != 0)
+	{
+		hash_clear();
+	}
+	for (hash_entry *e = command_hash[hash_name(name)]; e != NULL; e = e->next)
+	{
+		if (strcmp(e->name, name) == 0)
+		{
+			return e;
+		}
+	}
+	return NULL;
+}
+// returns the cached absolute path of name, resolving it on a miss
+// NULL when name contains a '/' or is not found, the caller then execs name as is
+char *hash_lookup(const char *name)
+{
+	hash_entry *e;
+	char *path;
+
+	if (strchr(name, '/') != NULL)
+	{
+		return NULL;
+	}
+	e = hash_find(name);
+	if (e != NULL)
+	{
+		e->hits++;
+		return e->path;
+	}
+	path = search_path(name);
+	if (path == NULL)
+	{
+		return NULL;
+	}
+	e = malloc(sizeof(hash_entry));
+	if (e == NULL || (e->name = strdup(name)) == NULL)
+	{
+		free(e);
+		free(path);
+		return NULL;
+	}
+	if (hashed_path_env == NULL)
+	{
+		hashed_path_env = strdup(getenv("PATH") != NULL ? getenv("PATH") : "");
+	}
+	e->path = path;
+	e->hits = 1;
+	e->next = command_hash[hash_name(name)];
+	command_hash[hash_name(name)] = e;
+	return e->path;
+}
+// stale entry, e.g. the binary was removed since it was hashed
+void hash_forget(const char *name)
+{
+	hash_entry **link = &command_hash[hash_name(name)];
+	while (*link != NULL)
+	{
+		if (strcmp((*link)->name, name) == 0)
+		{
+			hash_entry *e = *link;
+			*link = e->next;
+			free(e->name);
+			free(e->path);
+			free(e);
+			return;
+		}
+		link = &(*link)->next;
+	}
+}
+// hash: list the table, hash -r: empty it, hash name...: resolve and remember names
+int builtin_hash(int count, char **arglist)
+{
+	if (count == 1)
+	{
+		int empty = 1;
+		for (int i = 0; i < HASH_BUCKETS; i++)
+		{
+			for (hash_entry *e = command_hash[i]; e != NULL; e = e->next)
+			{
+				if (empty)
+				{
+					printf("hits\tcommand\n");
+					empty = 0;
+				}
+				printf("%4lu\t%s\n", e->hits, e->path);
+			}
+		}
+		if (empty)
+		{
+			printf("hash: hash table empty\n");
+		}
+		return 1;
+	}
+	for (int i = 1; i < count; i++)
+	{
+		if (strcmp(arglist[i], "-r") == 0)
+		{
+			hash_clear();
+		}
+		else if (hash_lookup(arglist[i]) == NULL)
+		{
+			fprintf(stderr, "hash: %s: not found\n", arglist[i]);
+			last_status = 1;
+		}
+		else
+		{
+			// looking a name up to add it is not a use of the command
+			hash_find(arglist[i])->hits--;
+		}
+	}
+	return 1;
+}
+int builtin_cd(int count, char **arglist)
+{
+	char *dir = count > 1 ? arglist[1] : getenv("HOME");
+	char cwd[4096];
+
+	if (dir == NULL)
+	{
+		fprintf(stderr, "cd: HOME not set\n");
+		last_status = 1;
+		return 1;
+	}
+	if (chdir(dir) == -1)
+	{
+		fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+		last_status = 1;
+		return 1;
+	}
+	if (getcwd(cwd, sizeof(cwd)) != NULL)
+	{
+		setenv("PWD", cwd, 1);
+	}
+	return 1;
+}
+int builtin_exit(int count, char **arglist)
+{
+	if (count > 1 && in_forked_builtin)
+	{
+		// "exit 2 | cat" or "exit 2 &": only this copy ends. exit() would rewind the script
+		// shared with the shell, and finalize would tear down the shell's trace, zygote and coprocesses
+		fflush(stdout);
+		_exit(atoi(arglist[1]));
+	}
+	if (count > 1)
+	{
+		// explicit status: nothing is left to return to, leave right here
+		fflush(stdout);
+		finalize();
+		exit(atoi(arglist[1]));
+	}
+	return 0;
+}
+int builtin_echo(int count, char **arglist)
+{
+	int i = 1, newline = 1;
+	if (count > 1 && strcmp(arglist[1], "-n") == 0)
+	{
+		newline = 0;
+		i++;
+	}
+	for (; i < count; i++)
+	{
+		fputs(arglist[i], stdout);
+		if (i < count - 1)
+		{
+			putchar(' ');
+		}
+	}
+	if (newline)
+	{
+		putchar('\n');
+	}
+	return 1;
+}
+int builtin_true(int count, char **arglist)
+{
+	return 1;
+}
+int builtin_false(int count, char **arglist)
+{
+	last_status = 1;
+	return 1;
+}
+int builtin_pwd(int count, char **arglist)
+{
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+	{
+		fprintf(stderr, "pwd: %s\n", strerror(errno));
+		last_status = 1;
+		return 1;
+	}
+	printf("%s\n", cwd);
+	return 1;
+}
+// export NAME=value... sets variables for every later command, export alone lists them
+int builtin_export(int count, char **arglist)
+{
+	if (count == 1)
+	{
+		for (char **env = environ; *env != NULL; env++)
+		{
+			printf("export %s\n", *env);
+		}
+		return 1;
+	}
+	for (int i = 1; i < count; i++)
+	{
+		char *eq = strchr(arglist[i], '=');
+		if (eq == NULL)
+		{
+			// there are no unexported shell variables, nothing to do
+			continue;
+		}
+		*eq = '\0';
+		if (eq == arglist[i] || setenv(arglist[i], eq + 1, 1) == -1)
+		{
+			fprintf(stderr, "export: %s: not a valid identifier\n", arglist[i]);
+			last_status = 1;
+		}
+		*eq = '=';
+	}
+	return 1;
+}
+// ===================== job table =====================
+
+// space separated copy of argv, for "jobs"
+char *join_args(char **argv)
+{
+	size_t len = 1;
+	char *res;
+	for (int i = 0; argv[i] != NULL; i++)
+	{
+		len += strlen(argv[i]) + 1;
+	}
+	res = malloc(len);
+	if (res == NULL)
+	{
+		return NULL;
+	}
+	res[0] = '\0';
+	for (int i = 0; argv[i] != NULL; i++)
+	{
+		if (i > 0)
+		{
+			strcat(res, " ");
+		}
+		strcat(res, argv[i]);
+	}
+	return res;
+}
+// RETURNS - 1 on success, 0 if the job could not be tracked (it still runs and is reaped on exit)
+int job_add(pid_t pid, char **argv)
+{
+	job_t *job;
+	struct epoll_event ev;
+
+	if (finished_jobs > MAX_FINISHED_JOBS)
+	{
+		job_drop_finished(MAX_FINISHED_JOBS / 2);
+	}
+	if (njobs == jobs_capacity)
+	{
+		int capacity = jobs_capacity == 0 ? 16 : jobs_capacity * 2;
+		job_t *table = realloc(job_table, capacity * sizeof(job_t));
+		if (table == NULL)
+		{
+			fprintf(stderr, "realloc failed: %s\n", strerror(errno));
+			return 0;
+		}
+		job_table = table;
+		jobs_capacity = capacity;
+	}
+	job = &job_table[njobs];
+	job->id = next_job_id++;
+	job->pid = pid;
+	job->running = 1;
+	job->status = 0;
+	job->cpu = -1;
+	job->throttled = 0;
+	job->command = join_args(argv);
+	job->pidfd = -1;
+	if (child_signalfd == -1)
+	{
+		// a child that already exited is a zombie, its pidfd still becomes readable
+		job->pidfd = syscall(SYS_pidfd_open, pid, 0);
+		if (job->pidfd == -1)
+		{
+			fprintf(stderr, "pidfd_open error %s\n", strerror(errno));
+			free(job->command);
+			return 0;
+		}
+		ev.events = EPOLLIN;
+		// the id, not an index: indices move as jobs are removed, ids never do
+		ev.data.u64 = job->id;
+		if (epoll_ctl(job_epoll, EPOLL_CTL_ADD, job->pidfd, &ev) == -1)
+		{
+			fprintf(stderr, "epoll_ctl error %s\n", strerror(errno));
+			close(job->pidfd);
+			free(job->command);
+			return 0;
+		}
+	}
+	njobs++;
+	return 1;
+}
+// seen is when the epoll wait returned, the trace shows it as the exit of the job
+void job_reaped(job_t *job, int status, double seen)
+{
+	TRACE(TRACE_EXIT, job->pid, seen, status, NULL, NULL);
+	TRACE(TRACE_REAP, job->pid, 0, 0, NULL, NULL);
+	job->running = 0;
+	job->status = status;
+	finished_jobs++;
+	if (job->throttled)
+	{
+		job->throttled = 0;
+		bg_running--;
+	}
+	if (job->pidfd != -1)
+	{
+		epoll_ctl(job_epoll, EPOLL_CTL_DEL, job->pidfd, NULL);
+		close(job->pidfd);
+		job->pidfd = -1;
+	}
+}
+// collects exited jobs; timeout_ms as for epoll_wait, -1 blocks until at least one event
+void reap_jobs(int timeout_ms)
+{
+	struct epoll_event events[64];
+	int status, n;
+
+	if (job_epoll == -1)
+	{
+		return;
+	}
+	n = epoll_wait(job_epoll, events, 64, timeout_ms);
+	double seen = trace_ring != NULL ? trace_now() : 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (events[i].data.u64 == 0)
+		{
+			struct signalfd_siginfo info;
+			// coalesced signals: drain the fd, then poll every running job
+			while (read(child_signalfd, &info, sizeof(info)) > 0)
+			{
+			}
+			for (int j = 0; j < njobs; j++)
+			{
+				if (job_table[j].running && waitpid(job_table[j].pid, &status, WNOHANG) == job_table[j].pid)
+				{
+					job_reaped(&job_table[j], status, seen);
+				}
+			}
+			continue;
+		}
+		int j = job_index(events[i].data.u64);
+		if (j != -1 && job_table[j].running && waitpid(job_table[j].pid, &status, WNOHANG) == job_table[j].pid)
+		{
+			job_reaped(&job_table[j], status, seen);
+		}
+	}
+	if (queue_head != NULL)
+	{
+		// reaped jobs freed their slots
+		start_queued();
+	}
+}
+void job_remove(int index)
+{
+	free(job_table[index].command);
+	if (!job_table[index].running)
+	{
+		finished_jobs--;
+	}
+	njobs--;
+	memmove(&job_table[index], &job_table[index + 1], (njobs - index) * sizeof(job_t));
+}
+// ids only grow and removal keeps the order, so the table is sorted by id, RETURNS - index or -1
+int job_index(int id)
+{
+	int lo = 0, hi = njobs - 1;
+	while (lo <= hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (job_table[mid].id == id)
+		{
+			return mid;
+		}
+		if (job_table[mid].id < id)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+	return -1;
+}
+// forgets the oldest finished jobs until keep are left, in one pass over the table
+void job_drop_finished(int keep)
+{
+	int drop = finished_jobs - keep, w = 0;
+	for (int r = 0; r < njobs; r++)
+	{
+		if (drop > 0 && !job_table[r].running)
+		{
+			free(job_table[r].command);
+			finished_jobs--;
+			drop--;
+			continue;
+		}
+		job_table[w++] = job_table[r];
+	}
+	njobs = w;
+}
+void describe_status(int status, char *buf, size_t len)
+{
+	if (WIFSIGNALED(status))
+	{
+		snprintf(buf, len, "Killed (%s)", strsignal(WTERMSIG(status)));
+	}
+	else if (WEXITSTATUS(status) != 0)
+	{
+		snprintf(buf, len, "Exit %d", WEXITSTATUS(status));
+	}
+	else
+	{
+		snprintf(buf, len, "Done");
+	}
+}
+// jobs: one line per job, finished ones are forgotten once listed; jobs -q: the background queue
+int builtin_jobs(int count, char **arglist)
+{
+	char state[64];
+
+	reap_jobs(0);
+	if (count > 1 && strcmp(arglist[1], "-q") == 0)
+	{
+		print_queue();
+		return 1;
+	}
+	for (int i = 0; i < njobs; i++)
+	{
+		job_t *job = &job_table[i];
+		if (job->running)
+		{
+			snprintf(state, sizeof(state), "Running");
+		}
+		else
+		{
+			describe_status(job->status, state, sizeof(state));
+		}
+		printf("[%d] %d %-16s %s\n", job->id, job->pid, state, job->command != NULL ? job->command : "");
+	}
+	for (int i = njobs - 1; i >= 0; i--)
+	{
+		if (!job_table[i].running)
+		{
+			job_remove(i);
+		}
+	}
+	return 1;
+}
+// wait: block until every job finished, wait %id|pid...: only until those did
+int builtin_wait(int count, char **arglist)
+{
+	int ids[count];
+	pid_t pids[count];
+
+	for (int i = 1; i < count; i++)
+	{
+		ids[i] = arglist[i][0] == '%' ? atoi(arglist[i] + 1) : 0;
+		pids[i] = arglist[i][0] == '%' ? 0 : atoi(arglist[i]);
+	}
+	while (1)
+	{
+		int pending = 0;
+		for (int j = njobs - 1; j >= 0; j--)
+		{
+			int wanted = count == 1;
+			for (int i = 1; i < count && !wanted; i++)
+			{
+				wanted = job_table[j].id == ids[i] || job_table[j].pid == pids[i];
+			}
+			if (!wanted)
+			{
+				continue;
+			}
+			if (job_table[j].running)
+			{
+				pending = 1;
+			}
+			else
+			{
+				// like sh, wait reports the status of a job it waited for
+				last_status = exit_code(job_table[j].status);
+				job_remove(j);
+			}
+		}
+		// a queued job always has a running one ahead of it, whose exit starts it
+		if (!pending && (count > 1 || queue_head == NULL))
+		{
+			return 1;
+		}
+		reap_jobs(-1);
+	}
+}
+// ===================== background throttle =====================
+
+// one malloc holding the pointers and then the strings, freed with a single free
+char **copy_args(char **argv)
+{
+	size_t n = 0, len = 0;
+	char **copy, *p;
+
+	for (; argv[n] != NULL; n++)
+	{
+		len += strlen(argv[n]) + 1;
+	}
+	copy = malloc((n + 1) * sizeof(char *) + len);
+	if (copy == NULL)
+	{
+		return NULL;
+	}
+	p = (char *)(copy + n + 1);
+	for (size_t i = 0; i < n; i++)
+	{
+		copy[i] = strcpy(p, argv[i]);
+		p += strlen(argv[i]) + 1;
+	}
+	copy[n] = NULL;
+	return copy;
+}
+// MemAvailable from /proc/meminfo, RETURNS - -1 if it cannot be read
+double mem_available_mb(void)
+{
+	FILE *f = fopen("/proc/meminfo", "r");
+	char line[256];
+	double kb = -1;
+
+	if (f == NULL)
+	{
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if (sscanf(line, "MemAvailable: %lf kB", &kb) == 1)
+		{
+			break;
+		}
+	}
+	fclose(f);
+	return kb < 0 ? -1 : kb / 1024;
+}
+// BG_MAX=N running background jobs at most, BG_MAX_LOAD=L none started while the 1-minute load
+// average is at least L, BG_MIN_MEM=MB none while less memory is available.
+// RETURNS - NULL if a background job may start now, else the variable holding it back
+const char *admission_block(void)
+{
+	char *max = getenv("BG_MAX");
+	char *load = getenv("BG_MAX_LOAD");
+	char *mem = getenv("BG_MIN_MEM");
+	double avg, mb;
+
+	if (bg_running == 0)
+	{
+		// nothing would ever exit to wake the queue, and the checks would starve it
+		return NULL;
+	}
+	if (max != NULL && atoi(max) > 0 && bg_running >= atoi(max))
+	{
+		return "BG_MAX";
+	}
+	if (load != NULL && *load != '\0' && getloadavg(&avg, 1) == 1 && avg >= atof(load))
+	{
+		return "BG_MAX_LOAD";
+	}
+	if (mem != NULL && *mem != '\0' && (mb = mem_available_mb()) >= 0 && mb < atof(mem))
+	{
+		return "BG_MIN_MEM";
+	}
+	return NULL;
+}
+// RETURNS - 1 if the job was queued, 0 if it could not be copied
+int queue_job(char **argv)
+{
+	queued_job_t *q = malloc(sizeof(queued_job_t));
+
+	if (q == NULL || (q->argv = copy_args(argv)) == NULL)
+	{
+		fprintf(stderr, "malloc failed: %s\n", strerror(errno));
+		free(q);
+		return 0;
+	}
+	for (int v = 0; v < SCHED_VARS; v++)
+	{
+		q->prefix[v] = sched_prefix[v] != NULL ? strdup(sched_prefix[v]) : NULL;
+	}
+	q->queued_at = trace_now();
+	q->next = NULL;
+	if (queue_tail != NULL)
+	{
+		queue_tail->next = q;
+	}
+	else
+	{
+		queue_head = q;
+	}
+	queue_tail = q;
+	queue_length++;
+	return 1;
+}
+// starts queued jobs from the front for as long as admission_block lets them
+void start_queued(void)
+{
+	while (queue_head != NULL && admission_block() == NULL)
+	{
+		queued_job_t *q = queue_head;
+		char *saved[SCHED_VARS];
+		double waited = trace_now() - q->queued_at;
+
+		queue_head = q->next;
+		if (queue_head == NULL)
+		{
+			queue_tail = NULL;
+		}
+		queue_length--;
+		queue_started++;
+		queue_wait_total += waited;
+		if (waited > queue_wait_max)
+		{
+			queue_wait_max = waited;
+		}
+		TRACE(TRACE_SPAN, 0, q->queued_at, 0, "queued", q->argv);
+		memcpy(saved, sched_prefix, sizeof(saved));
+		memcpy(sched_prefix, q->prefix, sizeof(saved));
+		// $? stays the status of the last command typed, this launch is not one
+		int saved_status = last_status;
+		start_background(q->argv);
+		last_status = saved_status;
+		memcpy(sched_prefix, saved, sizeof(saved));
+		for (int v = 0; v < SCHED_VARS; v++)
+		{
+			free(q->prefix[v]);
+		}
+		// the job table keeps its own copy of the command
+		free(q->argv);
+		free(q);
+	}
+}
+void print_queue(void)
+{
+	const char *held = admission_block();
+	double now = trace_now();
+
+	printf("queued %d, running %d%s%s\n", queue_length, bg_running, queue_head != NULL && held != NULL ? ", held by " : "",
+		   queue_head != NULL && held != NULL ? held : "");
+	if (queue_started > 0)
+	{
+		printf("started from the queue %lu, mean wait %.3fs, max wait %.3fs\n", queue_started,
+			   queue_wait_total / queue_started / 1e6, queue_wait_max / 1e6);
+	}
+	for (queued_job_t *q = queue_head; q != NULL; q = q->next)
+	{
+		char *command = join_args(q->argv);
+		printf("  %8.3fs %s\n", (now - q->queued_at) / 1e6, command != NULL ? command : "");
+		free(command);
+	}
+}
+// ===================== resource accounting =====================
+
+void record_stats(char **argv, pid_t pid, int status, struct timespec *start, struct rusage *ru)
+{
+	proc_stats *st = &stats_history[stats_total % STATS_HISTORY];
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	snprintf(st->command, sizeof(st->command), "%s", argv[0]);
+	st->pid = pid;
+	st->status = status;
+	st->wall = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+	st->user = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+	st->sys = ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+	st->maxrss = ru->ru_maxrss;
+	st->nvcsw = ru->ru_nvcsw;
+	st->nivcsw = ru->ru_nivcsw;
+	stats_total++;
+}
+// prints records [first, stats_total) that are still in the ring, followed by their totals
+void print_stats(FILE *out, unsigned long first, unsigned long max_records)
+{
+	double wall = 0, user = 0, sys = 0;
+	long maxrss = 0, nvcsw = 0, nivcsw = 0;
+	char state[64];
+
+	if (stats_total - first > max_records)
+	{
+		first = stats_total - max_records;
+	}
+	fprintf(out, "%8s %-16s %9s %9s %9s %10s %8s %8s  %s\n",
+			"pid", "status", "real", "user", "sys", "maxrss_kb", "vcsw", "ivcsw", "command");
+	for (unsigned long i = first; i < stats_total; i++)
+	{
+		proc_stats *st = &stats_history[i % STATS_HISTORY];
+		describe_status(st->status, state, sizeof(state));
+		fprintf(out, "%8d %-16s %9.3f %9.3f %9.3f %10ld %8ld %8ld  %s\n",
+				st->pid, state, st->wall, st->user, st->sys, st->maxrss, st->nvcsw, st->nivcsw, st->command);
+		// wall times of pipeline stages overlap, the slowest one bounds the total
+		wall = st->wall > wall ? st->wall : wall;
+		user += st->user;
+		sys += st->sys;
+		maxrss = st->maxrss > maxrss ? st->maxrss : maxrss;
+		nvcsw += st->nvcsw;
+		nivcsw += st->nivcsw;
+	}
+	fprintf(out, "%8s %-16s %9.3f %9.3f %9.3f %10ld %8ld %8ld\n",
+			"", "max/total", wall, user, sys, maxrss, nvcsw, nivcsw);
+}
+// stats [N]: resource usage of the last N (default 10) foreground processes
+int builtin_stats(int count, char **arglist)
+{
+	unsigned long n = count > 1 ? strtoul(arglist[1], NULL, 10) : 10;
+
+	if (n > STATS_HISTORY)
+	{
+		n = STATS_HISTORY;
+	}
+	if (stats_total == 0 || n == 0)
+	{
+		fprintf(stderr, "stats: no commands recorded\n");
+		return 1;
+	}
+	print_stats(stdout, stats_total - (n < stats_total ? n : stats_total), n);
+	return 1;
+}
+// time cmd...: runs cmd, then reports every process it started on stderr
+int time_command(int count, char **arglist)
+{
+	unsigned long first = stats_total;
+	struct timespec start, end;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = process_arglist(count, arglist);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (stats_total != first)
+	{
+		print_stats(stderr, first, STATS_HISTORY);
+	}
+	fprintf(stderr, "real %.3fs\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	return ret;
+}
+// ===================== coprocesses =====================
+
+coproc_t *find_coproc(const char *name)
+{
+	for (int i = 0; i < MAX_COPROCS; i++)
+	{
+		if (coprocs[i].name != NULL && strcmp(coprocs[i].name, name) == 0)
+		{
+			return &coprocs[i];
+		}
+	}
+	return NULL;
+}
+// the process sees EOF on its stdin and is reaped through the job table like any background job
+void coproc_close(coproc_t *co)
+{
+	if (co->to_fd != -1)
+	{
+		close(co->to_fd);
+	}
+	close(co->from_fd);
+	free(co->name);
+	co->name = NULL;
+}
+// coproc NAME cmd args...: starts cmd once, later queries are a cowrite and a coread instead of a
+// new process each. coproc alone lists the running ones.
+int builtin_coproc(int count, char **arglist)
+{
+	int to_cmd[2], from_cmd[2];
+	coproc_t *co = NULL;
+
+	if (count == 1)
+	{
+		for (int i = 0; i < MAX_COPROCS; i++)
+		{
+			if (coprocs[i].name != NULL)
+			{
+				printf("%s %d%s\n", coprocs[i].name, coprocs[i].pid, coprocs[i].to_fd == -1 ? " (input closed)" : "");
+			}
+		}
+		return 1;
+	}
+	if (count < 3)
+	{
+		fprintf(stderr, "coproc: usage: coproc NAME command [args]\n");
+		last_status = 2;
+		return 1;
+	}
+	if (find_coproc(arglist[1]) != NULL)
+	{
+		fprintf(stderr, "coproc: %s: already running\n", arglist[1]);
+		last_status = 1;
+		return 1;
+	}
+	for (int i = 0; i < MAX_COPROCS && co == NULL; i++)
+	{
+		if (coprocs[i].name == NULL)
+		{
+			co = &coprocs[i];
+		}
+	}
+	if (co == NULL)
+	{
+		fprintf(stderr, "coproc: more than %d coprocesses\n", MAX_COPROCS);
+		last_status = 1;
+		return 1;
+	}
+	if (make_pipe(to_cmd) == -1)
+	{
+		last_status = 1;
+		return 1;
+	}
+	if (make_pipe(from_cmd) == -1)
+	{
+		close(to_cmd[0]);
+		close(to_cmd[1]);
+		last_status = 1;
+		return 1;
+	}
+	// close-on-exec: later commands must not keep the coprocess from seeing EOF
+	fcntl(to_cmd[1], F_SETFD, FD_CLOEXEC);
+	fcntl(from_cmd[0], F_SETFD, FD_CLOEXEC);
+	launch_t cmd = {arglist + 2, to_cmd[0], from_cmd[1], to_cmd[1], NULL, NULL, 1};
+	const builtin_t *b = find_builtin(arglist[2]);
+	pid_t pid = b != NULL ? fork_builtin(b, &cmd) : launch_command(&cmd);
+	close(to_cmd[0]);
+	close(from_cmd[1]);
+	if (pid <= 0)
+	{
+		close(to_cmd[1]);
+		close(from_cmd[0]);
+		last_status = pid == 0 ? last_status : 1;
+		return pid == 0;
+	}
+	co->name = strdup(arglist[1]);
+	co->pid = pid;
+	co->to_fd = to_cmd[1];
+	co->from_fd = from_cmd[0];
+	co->start = co->len = 0;
+	job_add(pid, arglist + 2);
+	return 1;
+}
+// cowrite NAME words...: one line, the words separated by spaces
+int builtin_cowrite(int count, char **arglist)
+{
+	coproc_t *co = count > 1 ? find_coproc(arglist[1]) : NULL;
+	char *line;
+	int failed;
+
+	if (co == NULL || co->to_fd == -1)
+	{
+		fprintf(stderr, "cowrite: %s: no such coprocess%s\n", count > 1 ? arglist[1] : "",
+				co != NULL ? " input" : "");
+		last_status = 1;
+		return 1;
+	}
+	line = join_args(arglist + 2);
+	if (line == NULL)
+	{
+		last_status = 1;
+		return 1;
+	}
+	// a coprocess that already exited must not take the shell down with SIGPIPE
+	void (*old_pipe)(int) = signal(SIGPIPE, SIG_IGN);
+	failed = write_all(co->to_fd, line, strlen(line)) == -1 || write_all(co->to_fd, "\n", 1) == -1;
+	signal(SIGPIPE, old_pipe);
+	if (failed)
+	{
+		fprintf(stderr, "cowrite: %s: %s\n", co->name, strerror(errno));
+		last_status = 1;
+	}
+	free(line);
+	return 1;
+}
+// coread NAME [lines]: copies the next lines the coprocess wrote to stdout, status 1 at its EOF
+int builtin_coread(int count, char **arglist)
+{
+	coproc_t *co = count > 1 ? find_coproc(arglist[1]) : NULL;
+	int lines = count > 2 ? atoi(arglist[2]) : 1;
+
+	if (co == NULL)
+	{
+		fprintf(stderr, "coread: %s: no such coprocess\n", count > 1 ? arglist[1] : "");
+		last_status = 1;
+		return 1;
+	}
+	if (in_forked_builtin)
+	{
+		fprintf(stderr, "coread: only runs in the shell itself, not in the background or before a |\n");
+		last_status = 1;
+		return 1;
+	}
+	while (lines > 0)
+	{
+		char *nl = memchr(co->buf + co->start, '\n', co->len);
+		if (nl != NULL || co->len == COPROC_BUFFER)
+		{
+			// a line longer than the buffer comes out in buffer sized pieces
+			size_t n = nl != NULL ? (size_t)(nl - (co->buf + co->start)) + 1 : co->len;
+			fwrite(co->buf + co->start, 1, n, stdout);
+			co->start += n;
+			co->len -= n;
+			lines--;
+			continue;
+		}
+		memmove(co->buf, co->buf + co->start, co->len);
+		co->start = 0;
+		ssize_t n = read(co->from_fd, co->buf + co->len, COPROC_BUFFER - co->len);
+		if (n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			// EOF: an unterminated last line still counts
+			if (co->len > 0)
+			{
+				fwrite(co->buf, 1, co->len, stdout);
+				putchar('\n');
+				co->len = 0;
+				lines--;
+			}
+			if (lines > 0)
+			{
+				last_status = 1;
+			}
+			break;
+		}
+		co->len += n;
+	}
+	return 1;
+}
+// coclose NAME: ends the coprocess, coclose -w NAME only closes its input so the rest of its
+// output can still be read
+int builtin_coclose(int count, char **arglist)
+{
+	int input_only = count > 2 && strcmp(arglist[1], "-w") == 0;
+	coproc_t *co = count > 1 ? find_coproc(arglist[input_only ? 2 : 1]) : NULL;
+
+	if (co == NULL)
+	{
+		fprintf(stderr, "coclose: no such coprocess\n");
+		last_status = 1;
+		return 1;
+	}
+	if (!input_only)
+	{
+		coproc_close(co);
+	}
+	else if (co->to_fd != -1)
+	{
+		close(co->to_fd);
+		co->to_fd = -1;
+	}
+	return 1;
+}
+const builtin_t *find_builtin(const char *name)
+{
+	for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+	{
+		if (strcmp(builtins[i].name, name) == 0)
+		{
+			return &builtins[i];
+		}
+	}
+	return NULL;
+}
+// runs a builtin in the shell process, stdin/stdout are redirected for the call and then restored
+int run_builtin(const builtin_t *b, launch_t *cmd)
+{
+	int saved_in = -1, saved_out = -1;
+	int in_fd = cmd->in_fd, out_fd = cmd->out_fd;
+	int count = 0, ret = 1;
+
+	while (cmd->argv[count] != NULL)
+	{
+		count++;
+	}
+	if (cmd->in_path != NULL && (in_fd = open(cmd->in_path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+		last_status = 1;
+		return 1;
+	}
+	if (cmd->out_path != NULL && (out_fd = open(cmd->out_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1)
+	{
+		fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+		last_status = 1;
+		if (cmd->in_path != NULL)
+		{
+			close(in_fd);
+		}
+		return 1;
+	}
+	// saved copies are close-on-exec so commands spawned meanwhile never see them
+	if (in_fd != 0)
+	{
+		saved_in = fcntl(0, F_DUPFD_CLOEXEC, 10);
+		dup2(in_fd, 0);
+	}
+	if (out_fd != 1)
+	{
+		fflush(stdout);
+		saved_out = fcntl(1, F_DUPFD_CLOEXEC, 10);
+		dup2(out_fd, 1);
+	}
+
+	last_status = 0;
+	ret = b->run(count, cmd->argv);
+	fflush(stdout);
+
+	if (saved_in != -1)
+	{
+		dup2(saved_in, 0);
+		close(saved_in);
+	}
+	if (saved_out != -1)
+	{
+		dup2(saved_out, 1);
+		close(saved_out);
+	}
+	if (cmd->in_path != NULL)
+	{
+		close(in_fd);
+	}
+	if (cmd->out_path != NULL)
+	{
+		close(out_fd);
+	}
+	return ret;
+}
+// builtins that are not the last pipeline stage, or run in the background, get their own process
+pid_t fork_builtin(const builtin_t *b, launch_t *cmd)
+{
+	sched_ctl_t sched;
+	if (cmd->sched == NULL)
+	{
+		int rc = resolve_sched(&sched);
+		if (rc == -1)
+		{
+			return 0;
+		}
+		if (rc == 1)
+		{
+			cmd->sched = &sched;
+		}
+	}
+	double start = trace_ring != NULL ? trace_now() : 0;
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "Fork error %s\n", strerror((errno)));
+		return -1;
+	}
+	if (pid == 0)
+	{
+		int count = 0;
+		setup_child(cmd);
+		while (cmd->argv[count] != NULL)
+		{
+			count++;
+		}
+		last_status = 0;
+		in_forked_builtin = 1;
+		b->run(count, cmd->argv);
+		fflush(stdout);
+		_exit(last_status);
+	}
+	if (cmd->sched == &sched)
+	{
+		cmd->sched = NULL;
+	}
+	TRACE(TRACE_SPAN, 0, start, 0, "fork", cmd->argv);
+	TRACE(TRACE_START, pid, start, 0, NULL, cmd->argv);
+	return pid;
+}
+// signal and fd setup shared by every forked child, exits on failure
+void setup_child(launch_t *cmd)
+{
+	int in_fd = cmd->in_fd, out_fd = cmd->out_fd;
+
+	if (cmd->sched != NULL)
+	{
+		apply_sched(cmd->sched);
+	}
+	sigset_t none;
+	// SIGCHLD may be blocked in the shell for the signalfd, never in commands
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+	// background children inherit the ignored SIGINT of the shell
+	if (!cmd->background && signal(SIGINT, SIG_DFL) == SIG_ERR)
+	{
+		// child should terminate upon SIGINT
+		fprintf(stderr, "Child signal configuration error %s\n", strerror((errno)));
+		exit(1);
+	}
+	if (cmd->close_fd != -1)
+	{
+		close(cmd->close_fd);
+	}
+	if (cmd->in_path != NULL)
+	{
+		in_fd = open(cmd->in_path, O_RDONLY);
+		if (in_fd == -1)
+		{
+			fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+			exit(1);
+		}
+	}
+	if (cmd->out_path != NULL)
+	{
+		out_fd = open(cmd->out_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (out_fd == -1)
+		{
+			fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+			exit(1);
+		}
+	}
+	if (in_fd != 0)
+	{
+		if (dup2(in_fd, 0) == -1)
+		{
+			fprintf(stderr, "Duplication error %s\n", strerror((errno)));
+			exit(1);
+		}
+		close(in_fd);
+	}
+	if (out_fd != 1)
+	{
+		if (dup2(out_fd, 1) == -1)
+		{
+			fprintf(stderr, "Duplication error %s\n", strerror((errno)));
+			exit(1);
+		}
+		close(out_fd);
+	}
+}
+// child side of the fork fallback, never returns
+void exec_stage(launch_t *cmd)
+{
+	setup_child(cmd);
+	TRACE(TRACE_EXEC, getpid(), 0, 0, NULL, NULL);
+	if (cmd->path != NULL)
+	{
+		execv(cmd->path, cmd->argv);
+		// hashed path went stale, fall back to the PATH scan below
+	}
+	if (execvp(cmd->argv[0], cmd->argv) == -1)
+	{
+		fprintf(stderr, "execvp error %s\n", strerror((errno)));
+		// sh convention: 127 command not found, 126 found but not executable
+		exit(errno == ENOENT ? 127 : 126);
+	}
+	exit(1);
+}
+pid_t fork_command(launch_t *cmd)
+{
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "Fork error %s\n", strerror((errno)));
+		return -1;
+	}
+	if (pid == 0)
+	{
+		exec_stage(cmd);
+	}
+	return pid;
+}
+// posix_spawnp does not copy the page tables of the shell, so launch cost does not grow with its RSS
+// returns the pid, 0 if the command could not be executed (already reported), -1 if no process could be created
+pid_t spawn_command(launch_t *cmd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	short flags = 0;
+	pid_t pid;
+	int rc;
+	int in_fd = cmd->in_fd, out_fd = cmd->out_fd;
+
+	// redirections are opened here, as zygote_command does: a child-side open failing with ENOENT
+	// would look like a missing binary
+	if (cmd->in_path != NULL && (in_fd = open(cmd->in_path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+		last_status = 1;
+		return 0;
+	}
+	if (cmd->out_path != NULL && (out_fd = open(cmd->out_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1)
+	{
+		fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+		if (cmd->in_path != NULL)
+		{
+			close(in_fd);
+		}
+		last_status = 1;
+		return 0;
+	}
+	rc = posix_spawn_file_actions_init(&actions) != 0;
+	if (rc == 0 && posix_spawnattr_init(&attr) != 0)
+	{
+		posix_spawn_file_actions_destroy(&actions);
+		rc = 1;
+	}
+	if (rc != 0)
+	{
+		if (cmd->in_path != NULL)
+		{
+			close(in_fd);
+		}
+		if (cmd->out_path != NULL)
+		{
+			close(out_fd);
+		}
+		return fork_command(cmd);
+	}
+	// same fd wiring as exec_stage, performed by the spawn helper before exec
+	if (cmd->close_fd != -1)
+	{
+		rc |= posix_spawn_file_actions_addclose(&actions, cmd->close_fd);
+	}
+	if (in_fd != 0)
+	{
+		rc |= posix_spawn_file_actions_adddup2(&actions, in_fd, 0);
+		rc |= posix_spawn_file_actions_addclose(&actions, in_fd);
+	}
+	if (out_fd != 1)
+	{
+		rc |= posix_spawn_file_actions_adddup2(&actions, out_fd, 1);
+		rc |= posix_spawn_file_actions_addclose(&actions, out_fd);
+	}
+	if (!cmd->background)
+	{
+		// child should terminate upon SIGINT
+		sigemptyset(&sigs);
+		sigaddset(&sigs, SIGINT);
+		rc |= posix_spawnattr_setsigdefault(&attr, &sigs);
+		flags |= POSIX_SPAWN_SETSIGDEF;
+	}
+	// SIGCHLD may be blocked in the shell for the signalfd, never in commands
+	sigemptyset(&sigs);
+	rc |= posix_spawnattr_setsigmask(&attr, &sigs);
+	flags |= POSIX_SPAWN_SETSIGMASK;
+	rc |= posix_spawnattr_setflags(&attr, flags);
+	if (rc != 0)
+	{
+		posix_spawnattr_destroy(&attr);
+		posix_spawn_file_actions_destroy(&actions);
+		if (cmd->in_path != NULL)
+		{
+			close(in_fd);
+		}
+		if (cmd->out_path != NULL)
+		{
+			close(out_fd);
+		}
+		return fork_command(cmd);
+	}
+
+	if (cmd->path != NULL)
+	{
+		rc = posix_spawn(&pid, cmd->path, &actions, &attr, cmd->argv, environ);
+		if (rc == ENOENT)
+		{
+			// the hashed binary is gone, forget it and search PATH once more
+			hash_forget(cmd->argv[0]);
+			cmd->path = hash_lookup(cmd->argv[0]);
+		}
+	}
+	if (cmd->path == NULL || rc == ENOENT)
+	{
+		rc = cmd->path != NULL ? posix_spawn(&pid, cmd->path, &actions, &attr, cmd->argv, environ)
+							   : posix_spawnp(&pid, cmd->argv[0], &actions, &attr, cmd->argv, environ);
+	}
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (cmd->in_path != NULL)
+	{
+		close(in_fd);
+	}
+	if (cmd->out_path != NULL)
+	{
+		close(out_fd);
+	}
+	if (rc == EAGAIN || rc == ENOMEM)
+	{
+		fprintf(stderr, "Fork error %s\n", strerror(rc));
+		return -1;
+	}
+	if (rc != 0)
+	{
+		// exec failed on the child side, there is no process left to wait for
+		fprintf(stderr, "Spawn error %s\n", strerror(rc));
+		last_status = rc == ENOENT ? 127 : 126;
+		return 0;
+	}
+	// posix_spawn only returns once the child has called exec
+	TRACE(TRACE_EXEC, pid, 0, 0, NULL, NULL);
+	return pid;
+}
+// ===================== zygote pool =====================
+
+int send_with_fds(int sock, void *buf, size_t len, int *fds, int nfds)
+{
+	struct iovec iov = {buf, len};
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int) * 4)];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {0};
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds > 0)
+	{
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+	}
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+// RETURNS - bytes received (0 at EOF, -1 on error), the passed fds are stored in fds
+ssize_t recv_with_fds(int sock, void *buf, size_t len, int *fds, int nfds)
+{
+	struct iovec iov = {buf, len};
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int) * 4)];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg = {0};
+	ssize_t n;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	do
+	{
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n == -1 && errno == EINTR);
+	for (int i = 0; i < nfds; i++)
+	{
+		fds[i] = -1;
+	}
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (n > 0 && cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+	{
+		int received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (received < nfds ? received : nfds));
+	}
+	return n;
+}
+// pre-forked helper: waits for one request and becomes that command, never returns
+void zygote_helper(int sock, char *buf)
+{
+	zygote_request *req = (zygote_request *)buf;
+	int fds[3];
+	sigset_t none;
+
+	// same child setup as exec_stage, done before the request arrives. SIGINT stays ignored as in the
+	// shell until then, a Ctrl-C must not take the idle pool down
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+	if (recv_with_fds(sock, buf, ZYGOTE_MSG_MAX, fds, 3) < (ssize_t)sizeof(zygote_request) || fds[2] == -1)
+	{
+		// master or shell went away
+		_exit(0);
+	}
+	if (!req->background)
+	{
+		signal(SIGINT, SIG_DFL);
+	}
+	char *argv[req->argc + 1];
+	char *envp[req->envc + 1];
+	char *str = buf + sizeof(zygote_request);
+	char *path = NULL;
+	if (req->has_path)
+	{
+		path = str;
+		str += strlen(str) + 1;
+	}
+	for (int i = 0; i < req->argc; i++, str += strlen(str) + 1)
+	{
+		argv[i] = str;
+	}
+	argv[req->argc] = NULL;
+	for (int i = 0; i < req->envc; i++, str += strlen(str) + 1)
+	{
+		envp[i] = str;
+	}
+	envp[req->envc] = NULL;
+	// the helper was forked before any later cd, take over the directory of the shell
+	if (fchdir(fds[2]) == -1 || dup2(fds[0], 0) == -1 || dup2(fds[1], 1) == -1)
+	{
+		fprintf(stderr, "Duplication error %s\n", strerror((errno)));
+		_exit(1);
+	}
+	TRACE(TRACE_EXEC, getpid(), 0, 0, NULL, NULL);
+	if (path != NULL)
+	{
+		execve(path, argv, envp);
+	}
+	if (execvpe(argv[0], argv, envp) == -1)
+	{
+		fprintf(stderr, "execvp error %s\n", strerror((errno)));
+	}
+	_exit(errno == ENOENT ? 127 : 126);
+}
+// leaves only stdin, stdout, stderr and keep open
+void close_other_fds(int keep)
+{
+	if (keep > 3)
+	{
+		close_range(3, keep - 1, 0);
+	}
+	close_range(keep + 1, ~0U, 0);
+}
+// RETURNS - the helper pid, its socket stored in *sock
+pid_t zygote_new_helper(int *sock)
+{
+	static char *buf = NULL;
+	int sv[2];
+	pid_t pid;
+
+	if (buf == NULL && (buf = malloc(ZYGOTE_MSG_MAX)) == NULL)
+	{
+		return -1;
+	}
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+	{
+		return -1;
+	}
+	// CLONE_PARENT: the helper is a sibling of the master, i.e. a child of the shell
+	pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL, NULL, 0);
+	if (pid == 0)
+	{
+		// only its own socket may stay open, so EOF reaches it when the master exits
+		close_other_fds(sv[1]);
+		zygote_helper(sv[1], buf);
+	}
+	close(sv[1]);
+	if (pid == -1)
+	{
+		close(sv[0]);
+		return -1;
+	}
+	*sock = sv[0];
+	return pid;
+}
+// drops helpers whose socket hung up (killed, or exited) from the pool, their pids go to reply
+void zygote_prune(int *socks, pid_t *pids, int *ready, zygote_reply *reply)
+{
+	for (int i = *ready - 1; i >= 0; i--)
+	{
+		struct pollfd pfd = {socks[i], 0, 0};
+		if (poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR)))
+		{
+			close(socks[i]);
+			reply->dead[reply->ndead++] = pids[i];
+			(*ready)--;
+			socks[i] = socks[*ready];
+			pids[i] = pids[*ready];
+		}
+	}
+}
+// hands each request from the shell to a ready helper, replies with its pid, then refills the pool
+void zygote_master(int ctl)
+{
+	int socks[ZYGOTE_POOL];
+	pid_t pids[ZYGOTE_POOL];
+	int ready = 0;
+	char *buf = malloc(ZYGOTE_MSG_MAX);
+	int fds[3];
+	ssize_t len;
+	zygote_reply reply;
+
+	if (buf == NULL)
+	{
+		_exit(1);
+	}
+	while (1)
+	{
+		// the shell waits only for the hand-off, forking replacements happens while the command runs
+		while (ready < ZYGOTE_POOL)
+		{
+			if ((pids[ready] = zygote_new_helper(&socks[ready])) == -1)
+			{
+				break;
+			}
+			ready++;
+		}
+		len = recv_with_fds(ctl, buf, ZYGOTE_MSG_MAX, fds, 3);
+		reply.ndead = 0;
+		zygote_prune(socks, pids, &ready, &reply);
+		if (len <= 0)
+		{
+			// zygote_stop: the idle helpers end on EOF once their sockets close, the shell reaps them
+			for (int i = 0; i < ready; i++)
+			{
+				close(socks[i]);
+				reply.dead[reply.ndead++] = pids[i];
+			}
+			reply.pid = -1;
+			send(ctl, &reply, sizeof(reply), MSG_NOSIGNAL);
+			_exit(0);
+		}
+		reply.pid = -EAGAIN;
+		if (ready > 0)
+		{
+			ready--;
+			if (send_with_fds(socks[ready], buf, len, fds, 3) == 0)
+			{
+				reply.pid = pids[ready];
+			}
+			else
+			{
+				// died after the prune
+				reply.dead[reply.ndead++] = pids[ready];
+			}
+			close(socks[ready]);
+		}
+		for (int i = 0; i < 3; i++)
+		{
+			close(fds[i]);
+		}
+		if (send(ctl, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+		{
+			_exit(0);
+		}
+	}
+}
+int zygote_start(void)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+	{
+		fprintf(stderr, "zygote socket error %s\n", strerror(errno));
+		return -1;
+	}
+	fflush(NULL);
+	zygote_master_pid = fork();
+	if (zygote_master_pid == -1)
+	{
+		fprintf(stderr, "Fork error %s\n", strerror((errno)));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	if (zygote_master_pid == 0)
+	{
+		// the master holds nothing of the shell but the control socket
+		close_other_fds(sv[1]);
+		zygote_master(sv[1]);
+	}
+	close(sv[1]);
+	zygote_ctl = sv[0];
+	return 0;
+}
+// reads a master reply and reaps the helpers it lists, RETURNS - the helper given the request,
+// negative if none, 0 if the master is gone
+pid_t zygote_collect(int ctl)
+{
+	zygote_reply reply;
+
+	if (recv(ctl, &reply, sizeof(reply), 0) != sizeof(reply))
+	{
+		return 0;
+	}
+	for (int i = 0; i < reply.ndead && i < ZYGOTE_POOL; i++)
+	{
+		// the hang-up is seen while they exit, waiting for the zombie takes no time
+		waitpid(reply.dead[i], NULL, 0);
+	}
+	return reply.pid;
+}
+void zygote_stop(void)
+{
+	if (zygote_ctl == -1)
+	{
+		return;
+	}
+	// EOF ends the master, which closes the helper sockets, which ends the helpers
+	shutdown(zygote_ctl, SHUT_WR);
+	zygote_collect(zygote_ctl);
+	close(zygote_ctl);
+	zygote_ctl = -1;
+	waitpid(zygote_master_pid, NULL, 0);
+	zygote_master_pid = -1;
+}
+// same contract as spawn_command, the process comes ready-made from the pool
+pid_t zygote_command(launch_t *cmd)
+{
+	char *buf = malloc(ZYGOTE_MSG_MAX);
+	zygote_request *req = (zygote_request *)buf;
+	size_t len = sizeof(zygote_request);
+	int fds[3] = {cmd->in_fd, cmd->out_fd, -1};
+	pid_t pid = -1;
+
+	// /dev/fd/N of a process substitution would name an fd of the helper, not of the shell
+	if (buf == NULL || open_substitutions > 0 || (zygote_ctl == -1 && zygote_start() == -1))
+	{
+		free(buf);
+		return spawn_command(cmd);
+	}
+	req->background = cmd->background;
+	req->has_path = cmd->path != NULL;
+	req->argc = 0;
+	req->envc = 0;
+	for (int pass = 0; pass < 3; pass++)
+	{
+		char **strs = pass == 0 ? &cmd->path : pass == 1 ? cmd->argv : environ;
+		for (int i = 0; strs[i] != NULL && (pass != 0 || i == 0); i++)
+		{
+			size_t n = strlen(strs[i]) + 1;
+			if (len + n > ZYGOTE_MSG_MAX)
+			{
+				// does not fit one datagram
+				free(buf);
+				return spawn_command(cmd);
+			}
+			memcpy(buf + len, strs[i], n);
+			len += n;
+			req->argc += pass == 1;
+			req->envc += pass == 2;
+		}
+	}
+
+	if (cmd->in_path != NULL && (fds[0] = open(cmd->in_path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+		free(buf);
+		return 0;
+	}
+	if (cmd->out_path != NULL && (fds[1] = open(cmd->out_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1)
+	{
+		fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+		pid = 0;
+	}
+	else if ((fds[2] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)) == -1)
+	{
+		fprintf(stderr, "cwd error %s\n", strerror((errno)));
+		pid = 0;
+	}
+	else if (send_with_fds(zygote_ctl, buf, len, fds, 3) == -1 || (pid = zygote_collect(zygote_ctl)) == 0)
+	{
+		// master died, start over with a new one next time
+		fprintf(stderr, "zygote error %s\n", strerror(errno));
+		zygote_stop();
+		pid = spawn_command(cmd);
+	}
+	else if (pid < 0)
+	{
+		// empty pool, e.g. the process limit was hit while refilling
+		pid = spawn_command(cmd);
+	}
+	if (cmd->in_path != NULL)
+	{
+		close(fds[0]);
+	}
+	if (cmd->out_path != NULL && fds[1] != -1)
+	{
+		close(fds[1]);
+	}
+	if (fds[2] != -1)
+	{
+		close(fds[2]);
+	}
+	free(buf);
+	return pid;
+}
+// MYSHELL_LAUNCH=fork forces the fork+execvp path, e.g. for comparing launch latency,
+// MYSHELL_LAUNCH=zygote takes processes from the pre-forked pool
+// ===================== tracing =====================
+
+double trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+// name is label followed by the words of argv, either may be NULL, cut to fit the event
+void trace_record(int type, pid_t pid, double start, int arg, const char *label, char **argv)
+{
+	unsigned long slot = __atomic_fetch_add(&trace_ring->head, 1, __ATOMIC_RELAXED);
+	trace_event_t *ev = &trace_ring->events[slot % TRACE_RING];
+	double now = trace_now();
+	size_t len = 0;
+
+	ev->ts = start != 0 ? start : now;
+	ev->dur = type == TRACE_SPAN ? now - start : 0;
+	ev->pid = pid;
+	ev->type = type;
+	ev->arg = arg;
+	ev->name[0] = '\0';
+	if (label != NULL)
+	{
+		len = snprintf(ev->name, sizeof(ev->name), "%s", label);
+	}
+	for (int i = 0; argv != NULL && argv[i] != NULL && len < sizeof(ev->name) - 1; i++)
+	{
+		len += snprintf(ev->name + len, sizeof(ev->name) - len, len > 0 ? " %s" : "%s", argv[i]);
+	}
+}
+// called by prepare before the zygote master is forked, so helpers share the ring too
+int trace_start(void)
+{
+	char *path = getenv("MYSHELL_TRACE");
+	char *pid_mark;
+
+	if (path == NULL || *path == '\0')
+	{
+		return 0;
+	}
+	pid_mark = strstr(path, "%p");
+	if (pid_mark != NULL)
+	{
+		snprintf(trace_path, sizeof(trace_path), "%.*s%d%s", (int)(pid_mark - path), path, getpid(), pid_mark + 2);
+	}
+	else
+	{
+		snprintf(trace_path, sizeof(trace_path), "%s", path);
+	}
+	// shared, so events recorded by forked children land in the same ring; pages are only
+	// allocated as the ring fills
+	trace_ring = mmap(NULL, sizeof(trace_buffer_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (trace_ring == MAP_FAILED)
+	{
+		trace_ring = NULL;
+		fprintf(stderr, "trace buffer error %s\n", strerror(errno));
+		return -1;
+	}
+	trace_owner = getpid();
+	return 0;
+}
+void trace_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str != '\0'; str++)
+	{
+		if (*str == '"' || *str == '\\')
+		{
+			fprintf(out, "\\%c", *str);
+		}
+		else if ((unsigned char)*str < 0x20)
+		{
+			fprintf(out, "\\u%04x", *str);
+		}
+		else
+		{
+			fputc(*str, out);
+		}
+	}
+	fputc('"', out);
+}
+// every process is a track of the shell, named after its command; once the ring wrapped only
+// the newest TRACE_RING events are left
+void trace_dump(void)
+{
+	static const char *phases[] = {"X", "B", "i", "i", "E", "i"};
+	static const char *names[] = {NULL, NULL, "exec", "first byte", NULL, "reap"};
+	unsigned long head = trace_ring->head;
+	unsigned long first = head > TRACE_RING ? head - TRACE_RING : 0;
+	pid_t shell = getpid();
+	FILE *out = fopen(trace_path, "w");
+
+	if (out == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", trace_path, strerror(errno));
+		return;
+	}
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"shell\"}}", shell, shell);
+	for (unsigned long i = first; i < head; i++)
+	{
+		trace_event_t *ev = &trace_ring->events[i % TRACE_RING];
+		if (ev->type == TRACE_START)
+		{
+			fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", shell, ev->pid);
+			trace_json_string(out, ev->name);
+			fprintf(out, "}}");
+		}
+		fprintf(out, ",\n{\"name\":");
+		trace_json_string(out, names[ev->type] != NULL ? names[ev->type] : ev->name);
+		fprintf(out, ",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", phases[ev->type], ev->ts, shell,
+				ev->type == TRACE_SPAN ? shell : ev->pid);
+		if (ev->type == TRACE_SPAN)
+		{
+			fprintf(out, ",\"dur\":%.3f", ev->dur);
+		}
+		else if (*phases[ev->type] == 'i')
+		{
+			fprintf(out, ",\"s\":\"t\"");
+		}
+		if (ev->type == TRACE_FIRST_BYTE)
+		{
+			fprintf(out, ",\"args\":{\"pipe\":%d}", ev->arg);
+		}
+		else if (ev->type == TRACE_EXIT)
+		{
+			fprintf(out, ",\"args\":{\"status\":%d}", ev->arg);
+		}
+		fprintf(out, "}");
+	}
+	fprintf(out, "\n]}\n");
+	fclose(out);
+}
+// tracing only: records when the first byte shows up in each pipe of a pipeline. The read ends
+// arrive over sock as their writers start, duplicated, and are only polled, never read. A reader
+// that drains a write before the watcher looks hides it, the event then marks a later write.
+pid_t trace_pipe_watcher(int *sock)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+	{
+		fprintf(stderr, "socketpair error %s\n", strerror(errno));
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "Fork error %s\n", strerror((errno)));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	if (pid == 0)
+	{
+		// index 0 is the socket, then one entry per pipe, -1 once done with
+		static struct pollfd fds[1024];
+		static pid_t writers[1024];
+		static int indexes[1024];
+		int nfds = 1, open_fds = 1;
+		trace_pipe_msg msg;
+
+		// other pipes of the shell would otherwise keep a reader alive
+		close_other_fds(sv[1]);
+		fds[0].fd = sv[1];
+		fds[0].events = POLLIN;
+		while (open_fds > 0 && poll(fds, nfds, -1) != -1)
+		{
+			if (fds[0].revents != 0)
+			{
+				int fd = -1;
+				if (recv_with_fds(fds[0].fd, &msg, sizeof(msg), &fd, 1) <= 0)
+				{
+					// the shell started every stage
+					close(fds[0].fd);
+					fds[0].fd = -1;
+					open_fds--;
+				}
+				else if (fd != -1 && nfds == 1024)
+				{
+					close(fd);
+				}
+				else if (fd != -1)
+				{
+					fds[nfds].fd = fd;
+					fds[nfds].events = POLLIN;
+					writers[nfds] = msg.writer;
+					indexes[nfds++] = msg.index;
+					open_fds++;
+				}
+			}
+			for (int i = 1; i < nfds; i++)
+			{
+				if (fds[i].fd == -1 || fds[i].revents == 0)
+				{
+					continue;
+				}
+				// POLLHUP alone: the writer closed the pipe without writing anything
+				if (fds[i].revents & POLLIN)
+				{
+					trace_record(TRACE_FIRST_BYTE, writers[i], 0, indexes[i], NULL, NULL);
+				}
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				open_fds--;
+			}
+		}
+		_exit(0);
+	}
+	close(sv[1]);
+	*sock = sv[0];
+	return pid;
+}
+// ===================== scheduling controls =====================
+
+// RETURNS - index in sched_vars of a "NAME=value" word, -1 if it is not one
+int sched_var(const char *word)
+{
+	for (int i = 0; i < SCHED_VARS; i++)
+	{
+		size_t len = strlen(sched_vars[i]);
+		if (strncmp(word, sched_vars[i], len) == 0 && word[len] == '=')
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+// "0-3,8,10-11" RETURNS - 0 on success, -1 on a malformed or empty list
+int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+	while (*p != '\0')
+	{
+		char *end;
+		long first = strtol(p, &end, 10), last = first;
+		if (end == p || first < 0)
+		{
+			return -1;
+		}
+		if (*end == '-')
+		{
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first)
+			{
+				return -1;
+			}
+		}
+		if (last >= CPU_SETSIZE)
+		{
+			return -1;
+		}
+		for (long cpu = first; cpu <= last; cpu++)
+		{
+			CPU_SET(cpu, set);
+		}
+		if (*end == ',')
+		{
+			end++;
+		}
+		else if (*end != '\0')
+		{
+			return -1;
+		}
+		p = end;
+	}
+	return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+// fills s from the prefixes of the current line, falling back to the environment
+// RETURNS - 1 if anything is set, 0 if the command inherits everything, -1 on a bad value (reported)
+int resolve_sched(sched_ctl_t *s)
+{
+	static const struct
+	{
+		const char *name;
+		int value;
+	} policies[] = {{"other", SCHED_OTHER}, {"batch", SCHED_BATCH}, {"idle", SCHED_IDLE}, {"fifo", SCHED_FIFO}, {"rr", SCHED_RR}},
+	  io_classes[] = {{"rt", 1}, {"be", 2}, {"idle", 3}};
+	char *values[SCHED_VARS];
+	char *end;
+	int any = 0;
+
+	s->has_cpus = s->has_nice = 0;
+	s->policy = s->ioprio = -1;
+	s->priority = 0;
+	for (int i = 0; i < SCHED_VARS; i++)
+	{
+		values[i] = sched_prefix[i] != NULL ? sched_prefix[i] : getenv(sched_vars[i]);
+		// an empty value ("NICE=") switches the control off again
+		if (values[i] != NULL && *values[i] == '\0')
+		{
+			values[i] = NULL;
+		}
+		any |= values[i] != NULL;
+	}
+	if (!any)
+	{
+		return 0;
+	}
+	if (values[0] != NULL)
+	{
+		if (parse_cpu_list(values[0], &s->cpus) == -1)
+		{
+			fprintf(stderr, "Invalid CPUS value %s\n", values[0]);
+			return -1;
+		}
+		s->has_cpus = 1;
+	}
+	if (values[1] != NULL)
+	{
+		s->nice = strtol(values[1], &end, 10);
+		if (*end != '\0' || s->nice < -20 || s->nice > 19)
+		{
+			fprintf(stderr, "Invalid NICE value %s\n", values[1]);
+			return -1;
+		}
+		s->has_nice = 1;
+	}
+	if (values[2] != NULL)
+	{
+		// other, batch, idle, fifo[:prio] or rr[:prio]
+		char *prio = strchr(values[2], ':');
+		size_t len = prio != NULL ? (size_t)(prio - values[2]) : strlen(values[2]);
+		for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+		{
+			if (strlen(policies[i].name) == len && strncmp(policies[i].name, values[2], len) == 0)
+			{
+				s->policy = policies[i].value;
+			}
+		}
+		if (s->policy == SCHED_FIFO || s->policy == SCHED_RR)
+		{
+			s->priority = prio != NULL ? strtol(prio + 1, &end, 10) : 1;
+			if ((prio != NULL && *end != '\0') || s->priority < sched_get_priority_min(s->policy) ||
+				s->priority > sched_get_priority_max(s->policy))
+			{
+				s->policy = -1;
+			}
+		}
+		else if (prio != NULL)
+		{
+			s->policy = -1;
+		}
+		if (s->policy == -1)
+		{
+			fprintf(stderr, "Invalid SCHED value %s\n", values[2]);
+			return -1;
+		}
+	}
+	if (values[3] != NULL)
+	{
+		// rt[:level], be[:level] or idle, levels 0 (highest) to 7
+		char *level = strchr(values[3], ':');
+		size_t len = level != NULL ? (size_t)(level - values[3]) : strlen(values[3]);
+		int io_class = -1, io_level = 4;
+		for (size_t i = 0; i < sizeof(io_classes) / sizeof(io_classes[0]); i++)
+		{
+			if (strlen(io_classes[i].name) == len && strncmp(io_classes[i].name, values[3], len) == 0)
+			{
+				io_class = io_classes[i].value;
+			}
+		}
+		if (level != NULL)
+		{
+			io_level = strtol(level + 1, &end, 10);
+			if (*end != '\0' || io_class == 3)
+			{
+				io_class = -1;
+			}
+		}
+		if (io_class == -1 || io_level < 0 || io_level > 7)
+		{
+			fprintf(stderr, "Invalid IOPRIO value %s\n", values[3]);
+			return -1;
+		}
+		// IOPRIO_PRIO_VALUE(class, level)
+		s->ioprio = io_class << 13 | (io_class == 3 ? 0 : io_level);
+	}
+	return 1;
+}
+// child side, before exec: a setting that cannot be applied ends the child like a failed redirection
+void apply_sched(const sched_ctl_t *s)
+{
+	struct sched_param param = {.sched_priority = s->priority};
+
+	if (s->has_cpus && sched_setaffinity(0, sizeof(s->cpus), &s->cpus) == -1)
+	{
+		fprintf(stderr, "sched_setaffinity error %s\n", strerror((errno)));
+		exit(1);
+	}
+	if (s->policy != -1 && sched_setscheduler(0, s->policy, &param) == -1)
+	{
+		fprintf(stderr, "sched_setscheduler error %s\n", strerror((errno)));
+		exit(1);
+	}
+	if (s->has_nice && setpriority(PRIO_PROCESS, 0, s->nice) == -1)
+	{
+		fprintf(stderr, "setpriority error %s\n", strerror((errno)));
+		exit(1);
+	}
+	// IOPRIO_WHO_PROCESS, the calling process
+	if (s->ioprio != -1 && syscall(SYS_ioprio_set, 1, 0, s->ioprio) == -1)
+	{
+		fprintf(stderr, "ioprio_set error %s\n", strerror((errno)));
+		exit(1);
+	}
+}
+// BG_CPUS: the CPU of set running the fewest background jobs, ties broken round robin
+int pick_background_cpu(const cpu_set_t *set)
+{
+	static int load[CPU_SETSIZE];
+	int best = -1;
+
+	memset(load, 0, sizeof(load));
+	for (int i = 0; i < njobs; i++)
+	{
+		if (job_table[i].running && job_table[i].cpu != -1)
+		{
+			load[job_table[i].cpu]++;
+		}
+	}
+	for (int n = 0; n < CPU_SETSIZE; n++)
+	{
+		int cpu = (bg_next_cpu + n) % CPU_SETSIZE;
+		if (CPU_ISSET(cpu, set) && (best == -1 || load[cpu] < load[best]))
+		{
+			best = cpu;
+		}
+	}
+	bg_next_cpu = best + 1;
+	return best;
+}
+// "CPUS=0-3 NICE=5 cmd ...": the values hold for the rest of the line,
+// a line of nothing but such assignments exports them for every later command
+int perform_sched_prefix(int count, char **arglist)
+{
+	char *saved[SCHED_VARS];
+	int i = 0, v, ret;
+
+	while (i < count && sched_var(arglist[i]) != -1)
+	{
+		i++;
+	}
+	if (i == count)
+	{
+		for (i = 0; i < count; i++)
+		{
+			v = sched_var(arglist[i]);
+			if (setenv(sched_vars[v], arglist[i] + strlen(sched_vars[v]) + 1, 1) == -1)
+			{
+				fprintf(stderr, "setenv error %s\n", strerror((errno)));
+			}
+		}
+		return 1;
+	}
+	memcpy(saved, sched_prefix, sizeof(saved));
+	for (int j = 0; j < i; j++)
+	{
+		v = sched_var(arglist[j]);
+		sched_prefix[v] = arglist[j] + strlen(sched_vars[v]) + 1;
+	}
+	ret = process_arglist(count - i, arglist + i);
+	memcpy(sched_prefix, saved, sizeof(saved));
+	return ret;
+}
+pid_t launch_command(launch_t *cmd)
+{
+	char *mode = getenv("MYSHELL_LAUNCH");
+	double start = trace_ring != NULL ? trace_now() : 0;
+	const char *how = "spawn";
+	sched_ctl_t sched;
+	pid_t pid;
+
+	cmd->path = hash_lookup(cmd->argv[0]);
+	TRACE(TRACE_SPAN, 0, start, 0, "lookup", cmd->argv);
+	if (cmd->sched == NULL)
+	{
+		int rc = resolve_sched(&sched);
+		if (rc == -1)
+		{
+			last_status = 1;
+			return 0;
+		}
+		if (rc == 1)
+		{
+			// posix_spawn and the zygote cannot set affinity, nice or io priority, a forked child does
+			cmd->sched = &sched;
+		}
+	}
+	double launch_start = trace_ring != NULL ? trace_now() : 0;
+	if (cmd->sched != NULL || (mode != NULL && strcmp(mode, "fork") == 0))
+	{
+		how = "fork";
+		pid = fork_command(cmd);
+	}
+	else if (mode != NULL && strcmp(mode, "zygote") == 0)
+	{
+		how = "zygote";
+		pid = zygote_command(cmd);
+	}
+	else
+	{
+		pid = spawn_command(cmd);
+	}
+	if (cmd->sched == &sched)
+	{
+		cmd->sched = NULL;
+	}
+	if (pid > 0)
+	{
+		TRACE(TRACE_SPAN, 0, launch_start, 0, how, cmd->argv);
+		TRACE(TRACE_START, pid, start, 0, NULL, cmd->argv);
+	}
+	return pid;
+}
+// reaps a foreground process and records its resource usage, RETURNS - its wait status
+int wait_child(pid_t pid, char **argv, struct timespec *start)
+{
+	struct rusage ru;
+	int status = 0;
+	pid_t ret;
+	double wait_start = trace_ring != NULL ? trace_now() : 0, exited = 0;
+
+	if (trace_ring != NULL)
+	{
+		siginfo_t info;
+		// WNOWAIT leaves the zombie for wait4, so exit and reap are separate events
+		while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1 && errno == EINTR)
+		{
+		}
+		exited = trace_now();
+	}
+	do
+	{
+		ret = wait4(pid, &status, 0, &ru);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1)
+	{
+		if (errno != ECHILD)
+		{
+			fprintf(stderr, "Waiting for child error in parent %s\n", strerror((errno)));
+			exit(1);
+		}
+		// otherwise child process finished successfuly
+		return 0;
+	}
+	record_stats(argv, pid, status, start, &ru);
+	TRACE(TRACE_EXIT, pid, exited, status, NULL, NULL);
+	TRACE(TRACE_REAP, pid, 0, 0, NULL, NULL);
+	TRACE(TRACE_SPAN, 0, wait_start, 0, "wait", argv);
+	return status;
+}
+// builtin or external command in the foreground, RETURNS - 1 if should continue, 0 otherwise
+int run_foreground(launch_t *cmd)
+{
+	const builtin_t *b = find_builtin(cmd->argv[0]);
+	if (b != NULL)
+	{
+		return run_builtin(b, cmd);
+	}
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = launch_command(cmd);
+	if (pid < 0)
+	{
+		return 0;
+	}
+	// pid 0: nothing ran, the launch already set last_status
+	if (pid > 0)
+	{
+		last_status = exit_code(wait_child(pid, cmd->argv, &start));
+	}
+	return 1;
+}
+// "cmd < file", optionally followed by ">> file" like a here-document
+int perform_input_redirection(char **arglist, int redirect_index)
+{
+	launch_t cmd = {arglist, 0, 1, -1, arglist[redirect_index + 1], NULL, 0};
+	for (int i = redirect_index + 2; arglist[i] != NULL; i++)
+	{
+		if (is_op(arglist[i], ">>") && arglist[i + 1] != NULL)
+		{
+			cmd.out_path = arglist[i + 1];
+			break;
+		}
+	}
+	// remove redirection symbol for execution
+	arglist[redirect_index] = NULL;
+	return run_foreground(&cmd);
+}
+int perform_output_riderection(char **arglist, int redirect_index)
+{
+	launch_t cmd = {arglist, 0, 1, -1, NULL, arglist[redirect_index + 1], 0};
+	// Remove redirection symbol for execution
+	arglist[redirect_index] = NULL;
+	return run_foreground(&cmd);
+}
+// text of "<<< word" plus a newline, or a heredoc body as collected by shell.c, in a memfd
+// positioned at its start, so the command reads it without any file being created
+// RETURNS - the fd, -1 on failure (already reported)
+int here_document(char *text, int add_newline)
+{
+	size_t len = strlen(text), done = 0;
+	int fd = memfd_create("here-document", MFD_CLOEXEC);
+	if (fd == -1)
+	{
+		fprintf(stderr, "memfd error %s\n", strerror((errno)));
+		return -1;
+	}
+	while (done < len)
+	{
+		ssize_t n = write(fd, text + done, len - done);
+		if (n == -1)
+		{
+			fprintf(stderr, "here-document write error %s\n", strerror((errno)));
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+	if ((add_newline && write(fd, "\n", 1) != 1) || lseek(fd, 0, SEEK_SET) == -1)
+	{
+		fprintf(stderr, "here-document write error %s\n", strerror((errno)));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+// "cmd <<< word" and "cmd << body", optionally followed by ">> file": the memfd becomes stdin
+// through in_fd, the same dup2 a pipe read end gets
+int perform_here_redirection(char **arglist, int redirect_index)
+{
+	int fd = here_document(arglist[redirect_index + 1], is_op(arglist[redirect_index], "<<<"));
+	if (fd == -1)
+	{
+		return 1;
+	}
+	launch_t cmd = {arglist, fd, 1, -1, NULL, NULL, 0};
+	for (int i = redirect_index + 2; arglist[i] != NULL; i++)
+	{
+		if (is_op(arglist[i], ">>") && arglist[i + 1] != NULL)
+		{
+			cmd.out_path = arglist[i + 1];
+			break;
+		}
+	}
+	// remove redirection symbol for execution
+	arglist[redirect_index] = NULL;
+	int ret = run_foreground(&cmd);
+	close(fd);
+	return ret;
+}
+// pipe(), resized to $PIPE_SIZE bytes when set so large streams need fewer context switches
+// PIPE_SIZE in bytes, with an optional k or m suffix, RETURNS - 0 if unset or invalid
+long pipe_size(void)
+{
+	static char *parsed = NULL; // the value size was computed for, reparsed only when it changes
+	static long size = 0;
+	char *value = getenv("PIPE_SIZE");
+	char *end;
+
+	if (value == NULL || *value == '\0')
+	{
+		return 0;
+	}
+	if (parsed != NULL && strcmp(parsed, value) == 0)
+	{
+		return size;
+	}
+	free(parsed);
+	parsed = strdup(value);
+	errno = 0;
+	size = strtol(value, &end, 10);
+	if (*end == 'k' || *end == 'K')
+	{
+		size = size > LONG_MAX / 1024 ? -1 : size * 1024;
+		end++;
+	}
+	else if (*end == 'm' || *end == 'M')
+	{
+		size = size > LONG_MAX / (1024 * 1024) ? -1 : size * 1024 * 1024;
+		end++;
+	}
+	if (errno != 0 || end == value || *end != '\0' || size <= 0 || size > INT_MAX)
+	{
+		// said once per value, pipes keep the default size instead of shrinking to one page
+		fprintf(stderr, "Invalid PIPE_SIZE value %s\n", value);
+		size = 0;
+	}
+	return size;
+}
+int make_pipe(int pipefd[2])
+{
+	long size = pipe_size();
+	if (pipe(pipefd) == -1)
+	{
+		fprintf(stderr, "Pipe error %s\n", strerror((errno)));
+		return -1;
+	}
+	// the kernel rounds up to a power of two pages, above pipe-max-size it needs CAP_SYS_RESOURCE
+	if (size > 0 && fcntl(pipefd[0], F_SETPIPE_SZ, (int)size) == -1)
+	{
+		fprintf(stderr, "Pipe size error %s\n", strerror((errno)));
+	}
+	return 0;
+}
+// "a |> b": a process of the shell itself moves the stream with splice, the data never enters
+// user space, and the throughput of the pipe is reported on stderr at EOF
+pid_t fork_bridge(int in_fd, int out_fd, int unused_fd, char *from, char *to)
+{
+	double start = trace_ring != NULL ? trace_now() : 0;
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "Fork error %s\n", strerror((errno)));
+		return -1;
+	}
+	if (pid == 0)
+	{
+		struct timespec start, end;
+		long long total = 0;
+		ssize_t n;
+
+		signal(SIGINT, SIG_DFL);
+		// a consumer that quits early ends the copy with EPIPE, the report is still printed
+		signal(SIGPIPE, SIG_IGN);
+		close(unused_fd);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		while ((n = splice(in_fd, NULL, out_fd, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0)
+		{
+			total += n;
+		}
+		if (n == -1 && errno != EPIPE)
+		{
+			fprintf(stderr, "splice error %s\n", strerror(errno));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "%s |> %s: %lld bytes in %.3fs, %.1f MB/s\n",
+				from, to, total, secs, secs > 0 ? total / secs / 1e6 : 0.0);
+		_exit(0);
+	}
+	TRACE(TRACE_START, pid, start, 0, "|>", NULL);
+	return pid;
+}
+// runs "a | b | ... | z" with N-1 pipes, "<" allowed in the first stage and ">>" in the last
+int perform_pipe(char **arglist, int count)
+{
+	int stages[count];
+	// first word of each stage, "NAME=value" prefixes of the stage run from here to stages[i]
+	int assigns[count];
+	int nstages = 1;
+	char *in_path = NULL, *out_path = NULL;
+	int here_fd = -1;
+	pid_t pids[count];
+	struct timespec starts[count];
+	// bridges[i] is the splice process after stage i, 0 for a plain "|"
+	pid_t bridges[count];
+	struct timespec bridge_starts[count];
+	static char *bridge_argv[] = {"|>", NULL};
+	int i;
+
+	// split the arglist in place, every "|" or "|>" becomes the NULL terminating its stage
+	stages[0] = 0;
+	for (i = 0; i < count; i++)
+	{
+		bridges[nstages - 1] = is_op(arglist[i], "|>");
+		if (bridges[nstages - 1] || is_op(arglist[i], "|"))
+		{
+			arglist[i] = NULL;
+			stages[nstages++] = i + 1;
+		}
+	}
+	bridges[nstages - 1] = 0;
+	for (i = 0; i < nstages; i++)
+	{
+		assigns[i] = stages[i];
+		while (arglist[stages[i]] != NULL && sched_var(arglist[stages[i]]) != -1)
+		{
+			stages[i]++;
+		}
+		if (arglist[stages[i]] == NULL)
+		{
+			fprintf(stderr, "Syntax error: empty pipeline stage\n");
+			return 1;
+		}
+	}
+	for (i = stages[0]; arglist[i] != NULL; i++)
+	{
+		if (is_op(arglist[i], "<"))
+		{
+			in_path = arglist[i + 1];
+			arglist[i] = NULL;
+			break;
+		}
+		if ((is_op(arglist[i], "<<<") || is_op(arglist[i], "<<")) && arglist[i + 1] != NULL)
+		{
+			// the memfd feeds the first stage like the read end of a pipe would
+			here_fd = here_document(arglist[i + 1], arglist[i][2] == '<');
+			if (here_fd == -1)
+			{
+				return 1;
+			}
+			arglist[i] = NULL;
+			break;
+		}
+	}
+	for (i = stages[nstages - 1]; arglist[i] != NULL; i++)
+	{
+		if (is_op(arglist[i], ">>"))
+		{
+			out_path = arglist[i + 1];
+			arglist[i] = NULL;
+			break;
+		}
+	}
+
+	// the parent only ever holds the read end feeding the next stage
+	int prev_read = here_fd != -1 ? here_fd : 0;
+	int launched = 0, cont = 1;
+	int watch_sock = -1;
+	pid_t watcher = trace_ring != NULL ? trace_pipe_watcher(&watch_sock) : -1;
+	for (i = 0; i < nstages; i++)
+	{
+		int pipefd[2] = {-1, 1};
+		if (i < nstages - 1 && make_pipe(pipefd) == -1)
+		{
+			break;
+		}
+		launch_t cmd = {arglist + stages[i], prev_read, pipefd[1], pipefd[0],
+						i == 0 ? in_path : NULL, i == nstages - 1 ? out_path : NULL, 0};
+		const builtin_t *b = find_builtin(cmd.argv[0]);
+		char *saved[SCHED_VARS];
+		memcpy(saved, sched_prefix, sizeof(saved));
+		for (int j = assigns[i]; j < stages[i]; j++)
+		{
+			int v = sched_var(arglist[j]);
+			sched_prefix[v] = arglist[j] + strlen(sched_vars[v]) + 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &starts[i]);
+		if (b != NULL && i == nstages - 1)
+		{
+			// last stage builtin runs in the shell itself, reading from the pipe
+			pids[i] = 0;
+			cont = run_builtin(b, &cmd);
+		}
+		else if (b != NULL)
+		{
+			pids[i] = fork_builtin(b, &cmd);
+		}
+		else
+		{
+			pids[i] = launch_command(&cmd);
+		}
+		memcpy(sched_prefix, saved, sizeof(saved));
+		if (pids[i] < 0)
+		{
+			if (pipefd[0] != -1)
+			{
+				close(pipefd[0]);
+				close(pipefd[1]);
+			}
+			break;
+		}
+		launched++;
+		if (watch_sock != -1 && pipefd[0] != -1)
+		{
+			trace_pipe_msg msg = {i, pids[i]};
+			send_with_fds(watch_sock, &msg, sizeof(msg), &pipefd[0], 1);
+		}
+		// parent closes its copies right away so EOF propagates through the chain
+		if (prev_read != 0)
+		{
+			close(prev_read);
+		}
+		if (pipefd[0] != -1)
+		{
+			close(pipefd[1]);
+			prev_read = pipefd[0];
+		}
+		if (bridges[i])
+		{
+			// the next stage reads from a second pipe that the bridge fills
+			int bridged[2];
+			if (make_pipe(bridged) == -1)
+			{
+				bridges[i] = 0;
+				break;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &bridge_starts[i]);
+			bridges[i] = fork_bridge(prev_read, bridged[1], bridged[0], arglist[stages[i]], arglist[stages[i + 1]]);
+			close(prev_read);
+			close(bridged[1]);
+			prev_read = bridged[0];
+			if (bridges[i] < 0)
+			{
+				bridges[i] = 0;
+				break;
+			}
+		}
+	}
+	if (launched < nstages && prev_read != 0)
+	{
+		// stage after the failure will never exist, let the writer see EPIPE
+		close(prev_read);
+	}
+	if (watch_sock != -1)
+	{
+		close(watch_sock);
+	}
+	for (i = 0; i < launched; i++)
+	{
+		// stages that failed to exec have no process
+		if (pids[i] > 0)
+		{
+			int status = wait_child(pids[i], arglist + stages[i], &starts[i]);
+			// the status of a pipeline is that of its last stage
+			if (i == nstages - 1)
+			{
+				last_status = exit_code(status);
+			}
+		}
+		if (bridges[i] > 0)
+		{
+			wait_child(bridges[i], bridge_argv, &bridge_starts[i]);
+		}
+	}
+	if (watcher > 0)
+	{
+		while (waitpid(watcher, NULL, 0) == -1 && errno == EINTR)
+		{
+		}
+	}
+	return launched == nstages && cont;
+}
+// RETURNS - 0 once all of buf is written, -1 on error (errno set)
+int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, buf, len);
+		if (n == -1)
+		{
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+// "a |& { b , c , d }": the data in in_fd goes to every out_fds[i]. tee() duplicates it into all
+// consumer pipes but the last without consuming it, then splice() moves it into the last one, so
+// nothing passes through user space. Both block on a full consumer pipe, the slowest consumer sets
+// the pace. When a tee comes up short the rest of that chunk is read once and written to the
+// consumers still missing it. A consumer that exits is dropped, the others keep reading.
+pid_t fork_tee_bridge(int in_fd, int *out_fds, int nout)
+{
+	double start = trace_ring != NULL ? trace_now() : 0;
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		fprintf(stderr, "Fork error %s\n", strerror((errno)));
+		return -1;
+	}
+	if (pid == 0)
+	{
+		static char buf[1 << 16];
+		size_t got[nout];
+		int open_outs = nout;
+
+		signal(SIGINT, SIG_DFL);
+		signal(SIGPIPE, SIG_IGN);
+		while (open_outs > 0)
+		{
+			int first = -1, last = -1, short_tee = 0;
+			ssize_t n, m;
+			for (int i = 0; i < nout; i++)
+			{
+				if (out_fds[i] != -1)
+				{
+					first = first == -1 ? i : first;
+					last = i;
+				}
+			}
+			if (first == last)
+			{
+				// one consumer left, plain splice
+				n = splice(in_fd, NULL, out_fds[last], NULL, 1 << 20, SPLICE_F_MOVE);
+			}
+			else
+			{
+				// blocks until there is data and room for it
+				n = tee(in_fd, out_fds[first], 1 << 20, 0);
+			}
+			if (n == -1 && errno == EPIPE)
+			{
+				close(out_fds[first == last ? last : first]);
+				out_fds[first == last ? last : first] = -1;
+				open_outs--;
+				continue;
+			}
+			if (n <= 0)
+			{
+				if (n == -1)
+				{
+					fprintf(stderr, "tee error %s\n", strerror(errno));
+				}
+				break;
+			}
+			if (first == last)
+			{
+				continue;
+			}
+			got[first] = n;
+			for (int i = first + 1; i < last; i++)
+			{
+				if (out_fds[i] == -1)
+				{
+					continue;
+				}
+				m = tee(in_fd, out_fds[i], n, 0);
+				if (m == -1 && errno == EPIPE)
+				{
+					close(out_fds[i]);
+					out_fds[i] = -1;
+					open_outs--;
+					continue;
+				}
+				got[i] = m > 0 ? m : 0;
+				short_tee |= got[i] < (size_t)n;
+			}
+			got[last] = 0;
+			// the last consumer takes the chunk out of the producer pipe
+			while (!short_tee && got[last] < (size_t)n)
+			{
+				m = splice(in_fd, NULL, out_fds[last], NULL, n - got[last], SPLICE_F_MOVE);
+				if (m <= 0)
+				{
+					// EPIPE: the rest of the chunk is only read to drop it
+					close(out_fds[last]);
+					out_fds[last] = -1;
+					open_outs--;
+					short_tee = 1;
+					break;
+				}
+				got[last] += m;
+			}
+			for (size_t done = got[last]; short_tee && done < (size_t)n;)
+			{
+				m = read(in_fd, buf, n - done < sizeof(buf) ? n - done : sizeof(buf));
+				if (m <= 0)
+				{
+					break;
+				}
+				for (int i = first; i <= last; i++)
+				{
+					// the part of [done, done + m) consumer i does not have yet
+					size_t from = got[i] > done ? got[i] : done;
+					if (out_fds[i] != -1 && from < done + m &&
+						write_all(out_fds[i], buf + (from - done), done + m - from) == -1)
+					{
+						close(out_fds[i]);
+						out_fds[i] = -1;
+						open_outs--;
+					}
+				}
+				done += m;
+			}
+		}
+		_exit(0);
+	}
+	TRACE(TRACE_START, pid, start, 0, "|&", NULL);
+	return pid;
+}
+// "producer |& { c1 , c2 , ... }": every consumer reads all of the output of producer, through
+// its own pipe fed by a tee bridge. The producer may read "< file", each consumer may end in ">> file".
+int perform_fanout(char **arglist, int count)
+{
+	int fan = 0;
+	char *in_path = NULL;
+	// consumer argvs, NULL terminated one after another
+	char *words[2 * count];
+	int starts[count];
+	char *out_paths[count];
+	int nconsumers = 0, nwords = 0;
+	static char *tee_argv[] = {"|&", NULL};
+
+	while (!is_op(arglist[fan], "|&"))
+	{
+		fan++;
+	}
+	if (fan == 0 || fan + 2 >= count || !is_op(arglist[fan + 1], "{") || !is_op(arglist[count - 1], "}"))
+	{
+		fprintf(stderr, "Syntax error: expected producer |& { consumer , consumer ... }\n");
+		last_status = 2;
+		return 1;
+	}
+	arglist[fan] = NULL;
+	for (int i = 0; i < fan; i++)
+	{
+		if (is_op(arglist[i], "|") || is_op(arglist[i], "|>"))
+		{
+			fprintf(stderr, "Syntax error: the producer of |& is a single command\n");
+			last_status = 2;
+			return 1;
+		}
+		if (is_op(arglist[i], "<") && arglist[i + 1] != NULL)
+		{
+			in_path = arglist[i + 1];
+			arglist[i] = NULL;
+			break;
+		}
+	}
+	starts[0] = 0;
+	out_paths[0] = NULL;
+	for (int i = fan + 2; i < count; i++)
+	{
+		char *word = arglist[i];
+		size_t len = strlen(word);
+		// "c1," and "c1 ," both end a consumer, as does the closing "}"
+		int end = i == count - 1 || strcmp(word, ",") == 0 || word[len - 1] == ',';
+		if (i < count - 1 && strcmp(word, ",") != 0)
+		{
+			if (word[len - 1] == ',')
+			{
+				word[len - 1] = '\0';
+			}
+			if (is_op(word, ">>") && i + 1 < count - 1)
+			{
+				out_paths[nconsumers] = arglist[++i];
+				end |= arglist[i][strlen(arglist[i]) - 1] == ',';
+				if (end)
+				{
+					arglist[i][strlen(arglist[i]) - 1] = '\0';
+				}
+			}
+			else if (out_paths[nconsumers] == NULL && *word != '\0')
+			{
+				words[nwords++] = word;
+			}
+		}
+		if (end)
+		{
+			words[nwords++] = NULL;
+			if (words[starts[nconsumers]] == NULL)
+			{
+				fprintf(stderr, "Syntax error: empty |& consumer\n");
+				last_status = 2;
+				return 1;
+			}
+			starts[++nconsumers] = nwords;
+			out_paths[nconsumers] = NULL;
+		}
+	}
+
+	int producer_pipe[2], consumer_pipes[nconsumers][2], out_fds[nconsumers];
+	pid_t producer, consumers[nconsumers], bridge;
+	struct timespec producer_start, consumer_starts[nconsumers], bridge_start;
+	int launched = 0, ret = 1;
+
+	if (make_pipe(producer_pipe) == -1)
+	{
+		return 1;
+	}
+	// close-on-exec everywhere: no command may hold a pipe end of another one
+	fcntl(producer_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(producer_pipe[1], F_SETFD, FD_CLOEXEC);
+	for (int i = 0; i < nconsumers; i++)
+	{
+		if (make_pipe(consumer_pipes[i]) == -1)
+		{
+			for (int j = 0; j < i; j++)
+			{
+				close(consumer_pipes[j][0]);
+				close(consumer_pipes[j][1]);
+			}
+			close(producer_pipe[0]);
+			close(producer_pipe[1]);
+			return 1;
+		}
+		fcntl(consumer_pipes[i][0], F_SETFD, FD_CLOEXEC);
+		fcntl(consumer_pipes[i][1], F_SETFD, FD_CLOEXEC);
+	}
+
+	launch_t cmd = {arglist, 0, producer_pipe[1], producer_pipe[0], in_path, NULL, 0};
+	const builtin_t *b = find_builtin(arglist[0]);
+	clock_gettime(CLOCK_MONOTONIC, &producer_start);
+	producer = b != NULL ? fork_builtin(b, &cmd) : launch_command(&cmd);
+	close(producer_pipe[1]);
+	for (launched = 0; producer >= 0 && launched < nconsumers; launched++)
+	{
+		launch_t consumer = {words + starts[launched], consumer_pipes[launched][0], 1, consumer_pipes[launched][1],
+							 NULL, out_paths[launched], 0};
+		b = find_builtin(consumer.argv[0]);
+		clock_gettime(CLOCK_MONOTONIC, &consumer_starts[launched]);
+		consumers[launched] = b != NULL ? fork_builtin(b, &consumer) : launch_command(&consumer);
+		close(consumer_pipes[launched][0]);
+		consumer_pipes[launched][0] = -1;
+		out_fds[launched] = consumer_pipes[launched][1];
+		if (consumers[launched] < 0)
+		{
+			break;
+		}
+	}
+	if (producer < 0 || launched < nconsumers)
+	{
+		ret = 0;
+		bridge = -1;
+	}
+	else
+	{
+		clock_gettime(CLOCK_MONOTONIC, &bridge_start);
+		bridge = fork_tee_bridge(producer_pipe[0], out_fds, nconsumers);
+	}
+	// without a bridge the producer sees EPIPE and the consumers EOF
+	close(producer_pipe[0]);
+	for (int i = 0; i < nconsumers; i++)
+	{
+		if (consumer_pipes[i][0] != -1)
+		{
+			close(consumer_pipes[i][0]);
+		}
+		close(consumer_pipes[i][1]);
+	}
+
+	if (producer > 0)
+	{
+		wait_child(producer, arglist, &producer_start);
+	}
+	for (int i = 0; i < launched; i++)
+	{
+		if (consumers[i] > 0)
+		{
+			// like a pipeline, the status is that of the last command
+			last_status = exit_code(wait_child(consumers[i], words + starts[i], &consumer_starts[i]));
+		}
+	}
+	if (bridge > 0)
+	{
+		wait_child(bridge, tee_argv, &bridge_start);
+	}
+	return ret;
+}
+// "cat file... >> target" and "cat < file >> target" between regular files: done by the shell
+// with copy_file_range (sendfile as fallback) instead of a cat process copying through user space.
+// Unlike ">>", the target is not opened O_APPEND, which copy_file_range rejects: the data goes at
+// the size the target had when it was opened. Anything else appending to it meanwhile would be
+// overwritten, so while this shell has a job or coprocess running the real cat is used instead;
+// writers outside the shell are not detected.
+// RETURNS - -1 if the command is not a pure file to file copy, 1 otherwise
+int perform_file_copy(int count, char **arglist)
+{
+	char *sources[count];
+	int nsources = 0, redirected = 0;
+	char *target = NULL;
+	struct stat st, target_st;
+	off_t total = 0, off;
+	int out_fd;
+
+	for (int i = 1; i < count; i++)
+	{
+		if ((is_op(arglist[i], ">>") || is_op(arglist[i], "<")) && i + 1 < count)
+		{
+			if (arglist[i][0] == '>')
+			{
+				target = arglist[++i];
+			}
+			else
+			{
+				sources[nsources++] = arglist[++i];
+				redirected++;
+			}
+		}
+		else if (arglist[i][0] == '-' || arglist[i][0] == '<' || is_op(arglist[i], ">>"))
+		{
+			// options, stdin and here-strings need the real cat
+			return -1;
+		}
+		else
+		{
+			sources[nsources++] = arglist[i];
+		}
+	}
+	// with file operands cat never reads stdin, the "<" file is only opened: the real cat does that
+	if (target == NULL || nsources == 0 || (redirected > 0 && nsources > redirected))
+	{
+		return -1;
+	}
+	for (int i = 0; i < njobs; i++)
+	{
+		if (job_table[i].running)
+		{
+			return -1;
+		}
+	}
+	for (int i = 0; i < MAX_COPROCS; i++)
+	{
+		if (coprocs[i].name != NULL)
+		{
+			return -1;
+		}
+	}
+	for (int i = 0; i < nsources; i++)
+	{
+		// pipes, ttys and the like have no size to copy, nor do /proc files that report 0
+		if (stat(sources[i], &st) == 0)
+		{
+			if (!S_ISREG(st.st_mode) || st.st_size == 0)
+			{
+				return -1;
+			}
+			total += st.st_size;
+		}
+	}
+	if (stat(target, &target_st) == 0 && !S_ISREG(target_st.st_mode))
+	{
+		return -1;
+	}
+
+	// no O_APPEND, see above: the copy writes at explicit offsets from the end instead
+	last_status = 0;
+	out_fd = open(target, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (out_fd == -1 || fstat(out_fd, &target_st) == -1)
+	{
+		fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
+		last_status = 1;
+		if (out_fd != -1)
+		{
+			close(out_fd);
+		}
+		return 1;
+	}
+	off = target_st.st_size;
+	// reserve the appended range in one extent, the file size only grows as data lands; the sizes
+	// are only a hint, every source is copied up to its end whether it shrank or grew since
+	if (total > 0 && fallocate(out_fd, FALLOC_FL_KEEP_SIZE, off, total) == -1 && errno != EOPNOTSUPP)
+	{
+		fprintf(stderr, "fallocate error %s\n", strerror((errno)));
+	}
+	for (int i = 0; i < nsources; i++)
+	{
+		int in_fd = open(sources[i], O_RDONLY | O_CLOEXEC);
+		off_t in_off = 0;
+		ssize_t n = 0;
+		int use_sendfile = 0;
+
+		if (in_fd == -1 || fstat(in_fd, &st) == -1)
+		{
+			fprintf(stderr, "cat: %s: %s\n", sources[i], strerror(errno));
+			last_status = 1;
+			if (in_fd != -1)
+			{
+				close(in_fd);
+			}
+			continue;
+		}
+		if (st.st_dev == target_st.st_dev && st.st_ino == target_st.st_ino)
+		{
+			fprintf(stderr, "cat: %s: input file is output file\n", sources[i]);
+			last_status = 1;
+			close(in_fd);
+			continue;
+		}
+		while (1)
+		{
+			if (!use_sendfile)
+			{
+				n = copy_file_range(in_fd, &in_off, out_fd, &off, COPY_CHUNK, 0);
+				if (n == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+				{
+					// e.g. across filesystems on older kernels
+					use_sendfile = 1;
+					continue;
+				}
+			}
+			else
+			{
+				// sendfile writes at the file offset of out_fd
+				lseek(out_fd, off, SEEK_SET);
+				n = sendfile(out_fd, in_fd, &in_off, COPY_CHUNK);
+				if (n > 0)
+				{
+					off += n;
+				}
+			}
+			if (n <= 0)
+			{
+				// 0: end of the source
+				if (n == -1)
+				{
+					fprintf(stderr, "cat: %s: %s\n", sources[i], strerror(errno));
+					last_status = 1;
+				}
+				break;
+			}
+		}
+		close(in_fd);
+	}
+	close(out_fd);
+	return 1;
+}
+// "<(cmd args)" words: each cmd is started writing into a pipe, then the line runs with the
+// words replaced by /dev/fd/N of the read ends, which are the only pipe ends it inherits
+int perform_substitution(int count, char **arglist)
+{
+	pid_t pids[MAX_SUBSTITUTIONS];
+	struct timespec starts[MAX_SUBSTITUTIONS];
+	int fds[MAX_SUBSTITUTIONS];
+	char names[MAX_SUBSTITUTIONS][24];
+	// argv of every producer, each NULL terminated, taken from the words of the line
+	char *words[count + MAX_SUBSTITUTIONS];
+	char **argvs[MAX_SUBSTITUTIONS];
+	int background = is_op(arglist[count - 1], "&");
+	int nsubst = 0, newcount = 0, nwords = 0, ok = 1, ret = 1;
+
+	for (int i = 0; i < count && ok; i++)
+	{
+		if (!is_op(arglist[i], "<("))
+		{
+			arglist[newcount++] = arglist[i];
+			continue;
+		}
+		if (nsubst == MAX_SUBSTITUTIONS)
+		{
+			fprintf(stderr, "Syntax error: more than %d process substitutions\n", MAX_SUBSTITUTIONS);
+			ok = 0;
+			break;
+		}
+		// words up to the one ending in ')', "<(" and ")" may also stand alone
+		argvs[nsubst] = &words[nwords];
+		char *word = arglist[i] + 2;
+		while (1)
+		{
+			size_t len = strlen(word);
+			int last = len > 0 && word[len - 1] == ')';
+			if (last)
+			{
+				word[len - 1] = '\0';
+			}
+			if (*word != '\0')
+			{
+				words[nwords++] = word;
+			}
+			if (last)
+			{
+				break;
+			}
+			if (++i == count)
+			{
+				fprintf(stderr, "Syntax error: unterminated process substitution\n");
+				ok = 0;
+				break;
+			}
+			word = arglist[i];
 		}
-		int fd = open(arglist[redirect_index + 1], O_RDONLY);
-		if (fd == -1)
+		words[nwords++] = NULL;
+		if (!ok)
 		{
-			fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
-			exit(1);
+			break;
 		}
-		if (dup2(fd, 0) == -1)
+		if (argvs[nsubst][0] == NULL)
 		{
-			// redirect stdin to the input file
-			fprintf(stderr, "Duplication error %s\n", strerror((errno)));
-			exit(1);
+			fprintf(stderr, "Syntax error: empty process substitution\n");
+			ok = 0;
+			break;
 		}
-		// after redirecting file discriptor no longer needed
-		close(fd);
-		// remove redirection symbol for execution
-		arglist[redirect_index] = NULL;
-		if (execvp(arglist[0], arglist) == -1)
+
+		int pipefd[2];
+		if (make_pipe(pipefd) == -1)
 		{
-			fprintf(stderr, "execvp error %s\n", strerror((errno)));
-			exit(1);
+			ok = 0;
+			break;
 		}
-	}
-	// parent process
-	else if (waitpid(pid, NULL, 0) == -1)
-	{
-		if (errno != ECHILD && errno != EINTR)
+		// close-on-exec until every producer runs, so no producer holds another one's pipe
+		fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+		launch_t cmd = {argvs[nsubst], 0, pipefd[1], pipefd[0], NULL, NULL, background};
+		const builtin_t *b = find_builtin(cmd.argv[0]);
+		clock_gettime(CLOCK_MONOTONIC, &starts[nsubst]);
+		pids[nsubst] = b != NULL ? fork_builtin(b, &cmd) : launch_command(&cmd);
+		close(pipefd[1]);
+		if (pids[nsubst] < 0)
 		{
-			fprintf(stderr, "Waiting for child error in parent %s\n", strerror((errno)));
-			exit(1);
+			close(pipefd[0]);
+			ok = ret = 0;
+			break;
 		}
-		// otherwise child process finished successfuly
+		fds[nsubst] = pipefd[0];
+		snprintf(names[nsubst], sizeof(names[nsubst]), "/dev/fd/%d", pipefd[0]);
+		arglist[newcount++] = names[nsubst];
+		nsubst++;
 	}
-	return 1;
-}
-int perform_output_riderection(char **arglist, int redirect_index)
-{
-	pid_t pid = fork();
 
-	if (pid < 0)
-	{
-		fprintf(stderr, "Fork error %s\n", strerror((errno)));
-		return 0;
-	}
-	if (pid == 0)
+	if (ok)
 	{
-		// child process
-		if (signal(SIGINT, SIG_DFL) == SIG_ERR)
+		arglist[newcount] = NULL;
+		for (int i = 0; i < nsubst; i++)
 		{
-			// child should terminate upon SIGINT
-			fprintf(stderr, "Child signal configuration error %s\n", strerror((errno)));
-			exit(1);
-		}
-		int fd = open(arglist[redirect_index + 1], O_WRONLY | O_CREAT | O_APPEND, 0644);
-		if (fd == -1)
-		{
-			fprintf(stderr, "File discriptor error %s\n", strerror((errno)));
-			exit(1);
+			fcntl(fds[i], F_SETFD, 0);
 		}
-		if (dup2(fd, 1) == -1)
+		open_substitutions += nsubst;
+		ret = process_arglist(newcount, arglist);
+		open_substitutions -= nsubst;
+	}
+	for (int i = 0; i < nsubst; i++)
+	{
+		// a consumer that stopped early leaves its producer with EPIPE instead of blocked
+		close(fds[i]);
+		if (pids[i] > 0 && background)
 		{
-			// redirect stdin to the output file
-			fprintf(stderr, "Duplication error %s\n", strerror((errno)));
-			exit(1);
+			job_add(pids[i], argvs[i]);
 		}
-		// no need to use the fd anymore
-		close(fd);
-		// Remove redirection symbol for execution
-		arglist[redirect_index] = NULL;
-		if (execvp(arglist[0], arglist) == -1)
+		else if (pids[i] > 0)
 		{
-			fprintf(stderr, "execvp error %s\n", strerror((errno)));
-			exit(1);
+			wait_child(pids[i], argvs[i], &starts[i]);
 		}
 	}
-	// parent process
-	else if (waitpid(pid, NULL, 0) == -1)
+	return ret;
+}
+int background(char **arglist, int count)
+{
+	// ignore the & character for reading the command
+	arglist[count - 1] = NULL;
+	start_queued();
+	if (queue_head != NULL || admission_block() != NULL)
+	{
+		// behind the jobs already waiting, never ahead of them
+		last_status = queue_job(arglist) ? 0 : 1;
+		return 1;
+	}
+	return start_background(arglist);
+}
+// RETURNS - as process_arglist
+int start_background(char **arglist)
+{
+	// background child keeps ignoring SIGINT
+	launch_t cmd = {arglist, 0, 1, -1, NULL, NULL, 1};
+	const builtin_t *b = find_builtin(arglist[0]);
+	char *bg_cpus = getenv("BG_CPUS");
+	sched_ctl_t sched;
+	int cpu = -1;
+	int rc = resolve_sched(&sched);
+	if (rc == -1)
+	{
+		return 1;
+	}
+	if (bg_cpus != NULL && *bg_cpus != '\0' && !sched.has_cpus)
 	{
-		if (errno != ECHILD && errno != EINTR)
+		// spread concurrent jobs over the set, one CPU each
+		if (parse_cpu_list(bg_cpus, &sched.cpus) == -1)
 		{
-			fprintf(stderr, "Waiting for child error in parent %s\n", strerror((errno)));
-			exit(1);
+			fprintf(stderr, "Invalid BG_CPUS value %s\n", bg_cpus);
+			return 1;
 		}
-		// otherwise child process finished successfuly
+		cpu = pick_background_cpu(&sched.cpus);
+		CPU_ZERO(&sched.cpus);
+		CPU_SET(cpu, &sched.cpus);
+		sched.has_cpus = 1;
+		rc = 1;
+	}
+	if (rc == 1)
+	{
+		cmd.sched = &sched;
+	}
+	pid_t pid = b != NULL ? fork_builtin(b, &cmd) : launch_command(&cmd);
+	if (pid < 0)
+	{
+		return 0;
+	}
+	// parent process returns 1, the child is reaped through the job table
+	if (pid > 0 && job_add(pid, arglist))
+	{
+		job_table[njobs - 1].cpu = cpu;
+		job_table[njobs - 1].throttled = 1;
+		bg_running++;
+	}
+	if (pid > 0)
+	{
+		last_status = 0;
 	}
 	return 1;
 }
-int perform_pipe(char **arglist, int pipe_index)
+int perform_non_background(char **arglist)
 {
-	int pipefd[2];
-
-	pid_t pid1, pid2;
-
-	if (pipe(pipefd) == -1)
+	launch_t cmd = {arglist, 0, 1, -1, NULL, NULL, 0};
+	return run_foreground(&cmd);
+}
+// wait status -> shell status
+int exit_code(int status)
+{
+	if (WIFSIGNALED(status))
 	{
-		fprintf(stderr, "Pipe error %s\n", strerror((errno)));
-		return 0;
+		return 128 + WTERMSIG(status);
 	}
-	// creating first child for 1 end of the pipe
-	pid1 = fork();
-	if (pid1 < 0)
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+// RETURNS - 1 for ";" and "&", 2 for "&&" and "||", 0 for any other word
+int list_separator(const char *word)
+{
+	if (is_op(word, ";") || is_op(word, "&"))
 	{
-		fprintf(stderr, "Fork error %s\n", strerror((errno)));
-		return 0;
+		return 1;
 	}
-	// first child process
-	if (pid1 == 0)
+	if (is_op(word, "&&") || is_op(word, "||"))
 	{
-		if (signal(SIGINT, SIG_DFL) == SIG_ERR)
-		{
-			// child should terminate upon SIGINT
-			fprintf(stderr, "Child signal configuration error %s\n", strerror((errno)));
-			exit(1);
-		}
-		// closing reading end for this child
-		close(pipefd[0]);
-
-		if (dup2(pipefd[1], 1) == -1)
+		return 2;
+	}
+	return 0;
+}
+// "|", "|&" or "|>"
+int is_pipe_op(const char *word)
+{
+	return is_op(word, "|") || is_op(word, "|&") || is_op(word, "|>");
+}
+// index of the "}" closing the "{" at open, -1 if it is not closed before end.
+// As in sh, braces are only words of their own, "{" where a command starts and "}" after ";" or "&"
+int group_end(char **arglist, int open, int end)
+{
+	int depth = 0;
+	for (int i = open; i < end; i++)
+	{
+		if (is_op(arglist[i], "{") &&
+			(i == open || list_separator(arglist[i - 1]) || is_op(arglist[i - 1], "{")))
 		{
-			fprintf(stderr, "Duplication error %s\n", strerror((errno)));
-			exit(1);
+			depth++;
 		}
-		// close write end after duplication
-		close(pipefd[1]);
-		// preparing for the command execution
-		arglist[pipe_index] = NULL;
-		if (execvp(arglist[0], arglist) == -1)
+		else if (is_op(arglist[i], "}") && (list_separator(arglist[i - 1]) == 1 || is_op(arglist[i - 1], "}")) &&
+				 --depth == 0)
 		{
-			fprintf(stderr, "execvp error %s\n", strerror((errno)));
-			exit(1);
+			return i;
 		}
 	}
-	else // meant for parent process to create second child
+	return -1;
+}
+// runs the words [start, end) as "a ; b & c && d || { e ; f ; }" without any extra process: every
+// simple command goes to process_arglist in place, with its separator replaced by NULL meanwhile.
+// With execute 0 the list is only checked, so a syntax error is reported before anything runs.
+// RETURNS - 1 if should continue, 0 otherwise (exit, fork failure), -1 on a syntax error
+int run_list(char **arglist, int start, int end, int execute)
+{
+	int i = start;
+	// whether the next pipeline runs, decided by "&&" / "||" and last_status
+	int run = 1;
+
+	while (i < end)
 	{
-		// second child for 2nd pipe end
-		pid2 = fork();
-		if (pid2 < 0)
+		int stop = i, group_close = -1;
+		if (is_op(arglist[i], "{"))
 		{
-			fprintf(stderr, "Fork error %s\n", strerror((errno)));
-			exit(1);
-		}
-		// child process
-		if (pid2 == 0)
-		{
-			if (signal(SIGINT, SIG_DFL) == SIG_ERR)
+			group_close = group_end(arglist, i, end);
+			if (group_close == -1)
 			{
-				// child should terminate upon SIGINT
-				fprintf(stderr, "Child signal configuration error %s\n", strerror((errno)));
-				exit(1);
+				fprintf(stderr, "Syntax error: missing }\n");
+				return -1;
 			}
-			// no writing to the pipe
-			close(pipefd[1]);
-			if (dup2(pipefd[0], 0) == -1)
+			stop = group_close + 1;
+		}
+		while (stop < end && !list_separator(arglist[stop]))
+		{
+			stop++;
+		}
+		if (group_close != -1 && stop != group_close + 1)
+		{
+			// groups run in the shell process itself, there is no process whose output a pipe could take
+			if (is_pipe_op(arglist[group_close + 1]))
 			{
-				fprintf(stderr, "Duplication error %s\n", strerror((errno)));
-				exit(1);
+				fprintf(stderr, "Syntax error: a { } group cannot be piped\n");
 			}
-			// close the second end of the pipe
-			close(pipefd[0]);
-
-			if (execvp(arglist[pipe_index + 1], arglist + pipe_index + 1) == -1)
+			else
 			{
-				fprintf(stderr, "execvp error %s\n", strerror((errno)));
-				exit(1);
+				fprintf(stderr, "Syntax error near %s\n", arglist[group_close + 1]);
 			}
+			return -1;
 		}
-		else // parent process continues
+		if (stop == i)
 		{
-			close(pipefd[0]);
-			close(pipefd[1]);
-			if (waitpid(pid1, NULL, 0) == -1)
+			fprintf(stderr, "Syntax error near %s\n", stop < end ? arglist[stop] : "end of line");
+			return -1;
+		}
+		for (int j = i + 1; j < stop && group_close == -1; j++)
+		{
+			// after "|&" the braces hold the consumers of a fan-out, not a group
+			if (is_op(arglist[j], "{") && is_pipe_op(arglist[j - 1]) && !is_op(arglist[j - 1], "|&"))
 			{
-				if (errno != ECHILD && errno != EINTR)
-				{
-					fprintf(stderr, "Waiting for child error in parent %s\n", strerror((errno)));
-					exit(1);
-				}
-				// otherwise child process finished successfuly
+				fprintf(stderr, "Syntax error: a { } group cannot be piped\n");
+				return -1;
 			}
-			if (waitpid(pid2, NULL, 0) == -1)
+		}
+		int background = stop < end && is_op(arglist[stop], "&");
+		if (group_close != -1 && background)
+		{
+			fprintf(stderr, "Syntax error: a { } group cannot run in the background\n");
+			return -1;
+		}
+		if (stop < end && list_separator(arglist[stop]) == 2 && stop + 1 == end)
+		{
+			fprintf(stderr, "Syntax error: %s at end of line\n", arglist[stop]);
+			return -1;
+		}
+
+		int ret = 1;
+		if (group_close != -1)
+		{
+			// checked along with the outer list, then run when its turn comes
+			ret = run_list(arglist, i + 1, group_close, execute && run);
+		}
+		else if (execute && run)
+		{
+			// the "&" stays on the command, process_arglist puts it in the background
+			// background() clears the "&" itself, both words are put back afterwards
+			int words = stop - i + background;
+			char *separator = stop < end ? arglist[stop] : NULL;
+			char *saved = arglist[i + words];
+			arglist[i + words] = NULL;
+			ret = process_arglist(words, arglist + i);
+			arglist[i + words] = saved;
+			if (separator != NULL)
 			{
-				if (errno != ECHILD && errno != EINTR)
-				{
-					fprintf(stderr, "Waiting for child error in parent %s\n", strerror((errno)));
-					exit(1);
-				}
-				// otherwise child process finished successfuly
+				arglist[stop] = separator;
 			}
 		}
-	}
-	return 1;
-}
-int background(char **arglist, int count)
-{
-	pid_t pid;
-	// create child for background process
-	pid = fork();
-	// ignore the & character for reading the command
-	arglist[count - 1] = NULL;
-	if (pid == -1)
-	{
-		// fork failed
-		fprintf(stderr, "Fork error %s\n", strerror((errno)));
-		return 0;
-	}
-	// child process
-	if (pid == 0)
-	{
-		// ignore SIGINT during background process
-		if (signal(SIGINT, SIG_IGN) == SIG_ERR)
+		if (ret != 1)
 		{
-			fprintf(stderr, "Child signal configuration error %s\n", strerror((errno)));
-			exit(1);
+			return ret;
+		}
+
+		if (stop < end && list_separator(arglist[stop]) == 2)
+		{
+			// a skipped pipeline leaves last_status alone, so "a && b || c" runs c when a fails
+			run = is_op(arglist[stop], "&&") ? last_status == 0 : last_status != 0;
 		}
-		if (execvp(arglist[0], arglist) == -1)
+		else
 		{
-			fprintf(stderr, "execvp error %s\n", strerror((errno)));
-			exit(1);
+			run = 1;
 		}
+		i = stop + 1;
 	}
-	// parent process returns 1
 	return 1;
 }
-int perform_non_background(char **arglist)
+// a line holding ";", "&&", "||", a "&" before its end or a { } group
+int perform_list(int count, char **arglist)
 {
-	pid_t pid = fork();
-	if (pid == -1)
+	int ret = run_list(arglist, 0, count, 0);
+	if (ret == -1)
 	{
-		// fork failed
-		fprintf(stderr, "Fork error %s\n", strerror((errno)));
-		return 0;
+		last_status = 2;
+		return 1;
 	}
-	if (pid == 0)
+	return run_list(arglist, 0, count, 1) == 0 ? 0 : 1;
+}
+// arglist - a list of char* arguments (words) provided by the user
+// it contains count+1 items, where the last item (arglist[count]) and *only* the last is NULL,
+// operators are the words shell_operator returns, any other word is taken literally
+// RETURNS - 1 if should continue, 0 otherwise
+int process_arglist(int count, char **arglist)
+{
+	int input_riderect = 0, output_redirect = 0, here_redirect = 0, redirect_index = 0;
+
+	// collect background jobs that finished since the last command, without blocking
+	reap_jobs(0);
+
+	for (int i = 0; i < count; i++)
 	{
-		if (signal(SIGINT, SIG_DFL) == SIG_ERR)
+		if (list_separator(arglist[i]) == 2 || is_op(arglist[i], ";") ||
+			(is_op(arglist[i], "&") && i < count - 1) || (i == 0 && is_op(arglist[i], "{")))
 		{
-			// child should terminate upon SIGINT
-			fprintf(stderr, "Child signal configuration error %s\n", strerror((errno)));
-			exit(1);
+			return perform_list(count, arglist);
 		}
-		if (execvp(arglist[0], arglist) == -1)
+	}
+	for (int i = 0; i < count; i++)
+	{
+		if (is_op(arglist[i], "$?"))
 		{
-			fprintf(stderr, "execvp error %s\n", strerror((errno)));
-			exit(1);
+			static char status_word[16];
+			snprintf(status_word, sizeof(status_word), "%d", last_status);
+			arglist[i] = status_word;
 		}
 	}
-	// parent process
-	else if(waitpid(pid, NULL, 0) == -1)
+
+	if (strcmp(arglist[0], "time") == 0 && count > 1)
+	{
+		return time_command(count - 1, arglist + 1);
+	}
+
+	if (sched_var(arglist[0]) != -1)
+	{
+		return perform_sched_prefix(count, arglist);
+	}
+
+	for (int i = 0; i < count; i++)
 	{
-		if (errno != ECHILD && errno != EINTR)
+		if (is_op(arglist[i], "<("))
 		{
-			fprintf(stderr, "Waiting for child error in parent %s\n", strerror((errno)));
-			exit(1);
+			// producers start first, the rest of the line sees them as /dev/fd paths
+			return perform_substitution(count, arglist);
 		}
-		// otherwise child process finished successfuly
 	}
-	return 1;
-}
-// arglist - a list of char* arguments (words) provided by the user
-// it contains count+1 items, where the last item (arglist[count]) and *only* the last is NULL
-// RETURNS - 1 if should continue, 0 otherwise
-int process_arglist(int count, char **arglist)
-{
-	int pipe = 0, input_riderect = 0, output_redirect = 0, pipe_index = 0, redirect_index = 0;
 
-	if (strcmp(arglist[count - 1], "&") == 0)
+	if (is_op(arglist[count - 1], "&"))
 	{
 		// initialize background process
 		return background(arglist, count);
@@ -308,19 +3972,46 @@ int process_arglist(int count, char **arglist)
 	int i = 0;
 	while (i < count)
 	{
-		if (strcmp(arglist[i], "|") == 0)
+		if (is_op(arglist[i], "|&"))
 		{
-			pipe_index = i;
-			pipe = 1;
-			break;
+			return perform_fanout(arglist, count);
+		}
+		i++;
+	}
+	i = 0;
+	while (i < count)
+	{
+		if (is_op(arglist[i], "|") || is_op(arglist[i], "|>"))
+		{
+			// pipeline stages handle their own redirections
+			return perform_pipe(arglist, count);
 		}
-		if (strcmp(arglist[i], "<") == 0)
+		i++;
+	}
+	if (strcmp(arglist[0], "cat") == 0)
+	{
+		int ret = perform_file_copy(count, arglist);
+		if (ret != -1)
+		{
+			return ret;
+		}
+	}
+	i = 0;
+	while (i < count)
+	{
+		if (is_op(arglist[i], "<"))
 		{
 			input_riderect = 1;
 			redirect_index = i;
 			break;
 		}
-		if (strcmp(arglist[i], ">>") == 0)
+		if ((is_op(arglist[i], "<<<") || is_op(arglist[i], "<<")) && i + 1 < count)
+		{
+			here_redirect = 1;
+			redirect_index = i;
+			break;
+		}
+		if (is_op(arglist[i], ">>"))
 		{
 			output_redirect = 1;
 			redirect_index = i;
@@ -328,10 +4019,6 @@ int process_arglist(int count, char **arglist)
 		}
 		i++;
 	}
-	if (pipe)
-	{
-		return perform_pipe(arglist, pipe_index);
-	}
 	if (input_riderect)
 	{
 		return perform_input_redirection(arglist, redirect_index);
@@ -340,51 +4027,140 @@ int process_arglist(int count, char **arglist)
 	{
 		return perform_output_riderection(arglist, redirect_index);
 	}
+	if (here_redirect)
+	{
+		return perform_here_redirection(arglist, redirect_index);
+	}
 	// if code reached this point then it is a non background process
 	return perform_non_background(arglist);
 }
 
-void sigchld_handler(int sig)
-{
-	int saved_err = errno;
-	pid_t wait_pid;
-	while ((wait_pid = waitpid(-1, 0, WNOHANG)) > 0)
-	{
-		// zombies reaped
-	}
-	if (wait_pid == -1)
-	{
-		if (errno != ECHILD && errno != EINTR)
-		{
-			fprintf(stderr, "waiting failed for zombie handler Error: %s\n", strerror(errno));
-		}
-	}
-	errno = saved_err;
-}
 // prepare and finalize calls for initialization and destruction of anything required
 int prepare(void)
 {
 	// to complete in case of initializations
-	// set up handler for child to get rid of zombies
-	struct sigaction sa;
-	sa.sa_handler = sigchld_handler;
-	sa.sa_flags = SA_RESTART;
-	sigemptyset(&sa.sa_mask);
-	if (sigaction(SIGCHLD, &sa, NULL) < 0)
+	// background jobs are reaped from the job table's epoll loop, no SIGCHLD handler races the foreground waits
+	job_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (job_epoll == -1)
 	{
-		fprintf(stderr, "sigaction register fail Error %s\n", strerror(errno));
+		fprintf(stderr, "epoll_create failed, Error %s\n", strerror(errno));
 		return 1;
 	}
+	pid_t self_fd = syscall(SYS_pidfd_open, getpid(), 0);
+	if (self_fd != -1)
+	{
+		close(self_fd);
+	}
+	else
+	{
+		// no pidfd support, a blocked SIGCHLD delivered through a signalfd wakes the loop instead
+		sigset_t chld;
+		struct epoll_event ev;
+		sigemptyset(&chld);
+		sigaddset(&chld, SIGCHLD);
+		sigprocmask(SIG_BLOCK, &chld, NULL);
+		child_signalfd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+		ev.events = EPOLLIN;
+		// 0 is no job id
+		ev.data.u64 = 0;
+		if (child_signalfd == -1 || epoll_ctl(job_epoll, EPOLL_CTL_ADD, child_signalfd, &ev) == -1)
+		{
+			fprintf(stderr, "signalfd setup failed, Error %s\n", strerror(errno));
+			return 1;
+		}
+	}
 	if (signal(SIGINT, SIG_IGN) == SIG_ERR)
 	{
 		// parent process ignores SIGINT
 		fprintf(stderr, "parent signal register failed, Error %s\n", strerror(errno));
 		return 1;
 	}
+	// a batch worker already records into the ring of the batch parent
+	if (trace_ring == NULL && trace_start() == -1)
+	{
+		return 1;
+	}
+	char *mode = getenv("MYSHELL_LAUNCH");
+	if (mode != NULL && strcmp(mode, "zygote") == 0)
+	{
+		// started now, while the shell is small, the master forks helpers cheaply from then on
+		zygote_start();
+	}
 	return 0;
 }
 int finalize(void)
 {
 	// to complete if needed before exit
+	while (queue_head != NULL)
+	{
+		// queued jobs were accepted like any other "&", they still get to start
+		reap_jobs(-1);
+	}
+	for (int i = 0; i < MAX_COPROCS; i++)
+	{
+		if (coprocs[i].name != NULL)
+		{
+			coproc_close(&coprocs[i]);
+		}
+	}
+	if (trace_ring != NULL)
+	{
+		if (trace_owner == getpid())
+		{
+			trace_dump();
+		}
+		munmap(trace_ring, sizeof(trace_buffer_t));
+		trace_ring = NULL;
+	}
+	zygote_stop();
+	hash_clear();
+	for (int i = njobs - 1; i >= 0; i--)
+	{
+		// still running jobs are left to init, as before
+		if (job_table[i].pidfd != -1)
+		{
+			close(job_table[i].pidfd);
+		}
+		job_remove(i);
+	}
+	free(job_table);
+	job_table = NULL;
+	jobs_capacity = 0;
+	if (child_signalfd != -1)
+	{
+		close(child_signalfd);
+		child_signalfd = -1;
+	}
+	if (job_epoll != -1)
+	{
+		close(job_epoll);
+		job_epoll = -1;
+	}
+	return 0;
+}
+// shell -j: called once by the batch parent before the first worker is forked. The trace ring is
+// started here, so every worker records into it and a single file is written by finalize_batch.
+// The zygote pool is turned off, each worker would fork a master and a pool for its one line.
+int prepare_batch(void)
+{
+	char *mode = getenv("MYSHELL_LAUNCH");
+	if (mode != NULL && strcmp(mode, "zygote") == 0)
+	{
+		unsetenv("MYSHELL_LAUNCH");
+	}
+	return trace_start() == -1 ? 1 : 0;
+}
+int finalize_batch(void)
+{
+	if (trace_ring != NULL)
+	{
+		trace_dump();
+		munmap(trace_ring, sizeof(trace_buffer_t));
+		trace_ring = NULL;
+	}
 	return 0;
 }
+int shell_status(void)
+{
+	return last_status;
+}
@@ -1,9 +1,14 @@
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/wait.h>
 
 
 
@@ -18,53 +23,403 @@ int process_arglist(int count, char** arglist);
 int prepare(void);
 int finalize(void);
 
+// batch mode: setup shared by every worker, done once by the batch parent around all the lines
+int prepare_batch(void);
+int finalize_batch(void);
+// status of the last command run, what a batch worker exits with
+int shell_status(void);
+// the word every unquoted operator becomes, NULL if word is none; operators are matched by it,
+// so quoted text that reads like one stays an argument
+char* shell_operator(const char* word);
 
-int main(void)
+
+// most finished-but-unprinted outputs kept open while an earlier command is still running
+#define BATCH_WINDOW 512
+
+// exit status of a batch in which some line failed, the one xargs uses
+#define BATCH_FAILED 123
+
+// one line of a batch script, from fork until its output has been written out
+typedef struct batch_cmd
 {
-	if (prepare() != 0)
-		exit(1);
+	pid_t pid;
+	int out_fd;
+	int done;
+} batch_cmd;
 
-	while (1)
-	{
-		char** arglist = NULL;
-		char* line = NULL;
-		size_t size;
-		int count = 0;
 
-		if (getline(&line, &size, stdin) == -1) {
-			free(line);
-			break;
-		}
+// line buffer and word list reused for every line, grown geometrically and never shrunk,
+// so once they fit the longest line reading and tokenizing allocate nothing
+typedef struct line_arena
+{
+	char* line;
+	size_t line_size;
+	char** arglist;
+	int arglist_size;
+	char* here_line;	// heredoc lines are read here, line still holds the words
+	size_t here_line_size;
+	char* here_body;
+	size_t here_body_size;
+} line_arena;
+
 
-		arglist = (char**) malloc(sizeof(char*));
+static void push_word(line_arena* arena, int index, char* word)
+{
+	if (index == arena->arglist_size) {
+		int size = arena->arglist_size == 0 ? 16 : arena->arglist_size * 2;
+		char** arglist = (char**) realloc(arena->arglist, sizeof(char*) * size);
 		if (arglist == NULL) {
-			printf("malloc failed: %s\n", strerror(errno));
+			printf("realloc failed: %s\n", strerror(errno));
 			exit(1);
 		}
-		arglist[0] = strtok(line, " \t\n");
+		arena->arglist = arglist;
+		arena->arglist_size = size;
+	}
+	arena->arglist[index] = word;
+}
+
 
-		while (arglist[count] != NULL) {
-			++count;
-			arglist = (char**) realloc(arglist, sizeof(char*) * (count + 1));
-			if (arglist == NULL) {
-				printf("realloc failed: %s\n", strerror(errno));
-				exit(1);
+// splits arena->line in place into arena->arglist, honouring '...', "..." and backslash escapes.
+// Words are compacted inside the line itself, which is possible because unquoting only shrinks them.
+// An unquoted operator is replaced by the shell_operator word, which is how process_arglist tells
+// it from quoted text. An unquoted ';' and a leading "<(" are words of their own even without
+// blanks around them ("a; b", "<(cmd)"); the line has no room for the extra terminator, but the
+// shell_operator words need none.
+// RETURNS - the number of words, or -1 on an unterminated quote
+static int tokenize(line_arena* arena)
+{
+	char* r = arena->line;
+	char* w = arena->line;
+	int count = 0;
+
+	while (1) {
+		while (*r == ' ' || *r == '\t' || *r == '\n')
+			r++;
+		if (*r == '\0')
+			break;
+		if (*r == ';') {
+			r++;
+			push_word(arena, count++, shell_operator(";"));
+			continue;
+		}
+		if (r[0] == '<' && r[1] == '(') {
+			r += 2;
+			push_word(arena, count++, shell_operator("<("));
+			continue;
+		}
+
+		char* word = w;
+		// quoted: some part was quoted or escaped, literal: not only by "...", in which $? still expands
+		int quoted = 0, literal = 0;
+		while (*r != '\0' && *r != ' ' && *r != '\t' && *r != '\n' && *r != ';') {
+			if (*r == '\'') {
+				// everything up to the closing quote is literal
+				quoted = literal = 1;
+				r++;
+				while (*r != '\'' && *r != '\0')
+					*w++ = *r++;
+				if (*r == '\0')
+					return -1;
+				r++;
+			} else if (*r == '"') {
+				// only \" \\ \$ and \` are escapes inside double quotes
+				quoted = 1;
+				r++;
+				while (*r != '"' && *r != '\0') {
+					if (*r == '\\' && r[1] != '\0' && strchr("\"\\$`", r[1]) != NULL) {
+						literal = 1;
+						r++;
+					}
+					*w++ = *r++;
+				}
+				if (*r == '\0')
+					return -1;
+				r++;
+			} else if (*r == '\\' && r[1] != '\0' && r[1] != '\n') {
+				quoted = literal = 1;
+				r++;
+				*w++ = *r++;
+			} else {
+				*w++ = *r++;
 			}
+		}
+		int semicolon = *r == ';';
+		// the separator under r (if any) has been consumed, so w never overtakes r
+		if (*r != '\0')
+			r++;
+		*w++ = '\0';
+		if (!quoted && shell_operator(word) != NULL)
+			word = shell_operator(word);
+		else if (!literal && strcmp(word, "$?") == 0)
+			word = shell_operator(word);
+		push_word(arena, count++, word);
+		if (semicolon)
+			push_word(arena, count++, shell_operator(";"));
+	}
+	push_word(arena, count, NULL);
+	return count;
+}
+
 
-			arglist[count] = strtok(NULL, " \t\n");
+static void reserve_body(line_arena* arena, size_t size)
+{
+	if (size > arena->here_body_size) {
+		size_t grown = arena->here_body_size == 0 ? 256 : arena->here_body_size * 2;
+		char* body = (char*) realloc(arena->here_body, grown > size ? grown : size);
+		if (body == NULL) {
+			printf("realloc failed: %s\n", strerror(errno));
+			exit(1);
 		}
+		arena->here_body = body;
+		arena->here_body_size = grown > size ? grown : size;
+	}
+}
+
 
+// "cmd << DELIM": the lines that follow, up to one that is exactly DELIM, replace the DELIM word,
+// so process_arglist gets the body itself and can hand it to the command from memory
+static void read_heredoc(line_arena* arena, FILE* input, int count, int* lineno)
+{
+	char* delim = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i + 1 < count; i++) {
+		if (arena->arglist[i] == shell_operator("<<")) {
+			delim = arena->arglist[i + 1];
+			break;
+		}
+	}
+	if (delim == NULL)
+		return;
+
+	reserve_body(arena, 1);
+	while ((n = getline(&arena->here_line, &arena->here_line_size, input)) != -1) {
+		size_t text_len = n > 0 && arena->here_line[n - 1] == '\n' ? n - 1 : n;
+
+		++*lineno;
+		if (text_len == strlen(delim) && strncmp(arena->here_line, delim, text_len) == 0)
+			break;
+		reserve_body(arena, len + n + 1);
+		memcpy(arena->here_body + len, arena->here_line, n);
+		len += n;
+	}
+	if (n == -1)
+		fprintf(stderr, "line %d: warning: here-document delimited by end-of-file (wanted `%s')\n",
+				*lineno, delim);
+	arena->here_body[len] = '\0';
+	arena->arglist[i + 1] = arena->here_body;
+}
+
+
+// RETURNS - the word count of the next non-empty line, 0 at end of input
+static int next_line(line_arena* arena, FILE* input, int* lineno)
+{
+	while (getline(&arena->line, &arena->line_size, input) != -1) {
+		int count;
+
+		++*lineno;
+		count = tokenize(arena);
+		if (count == -1) {
+			fprintf(stderr, "line %d: syntax error: unterminated quote\n", *lineno);
+			continue;
+		}
 		if (count != 0) {
-			if (!process_arglist(count, arglist)) {
-				free(line);
-				free(arglist);
-				break;
-			}
+			read_heredoc(arena, input, count, lineno);
+			return count;
 		}
+	}
+	return 0;
+}
+
+
+static void free_arena(line_arena* arena)
+{
+	free(arena->line);
+	free(arena->arglist);
+	free(arena->here_line);
+	free(arena->here_body);
+}
 
-		free(line);
-		free(arglist);
+
+// worker side of batch mode: a private copy of the shell runs a single line, never returns
+static void run_batch_line(FILE* script, int count, char** arglist, int out_fd)
+{
+	// the worker's copy of the script buffer is dropped: with nothing read ahead, no exit() on any
+	// path (the exit builtin included) moves the script offset shared with the parent
+	__fpurge(script);
+	if (dup2(out_fd, 1) == -1 || dup2(out_fd, 2) == -1) {
+		fprintf(stderr, "dup2 failed: %s\n", strerror(errno));
+		_exit(1);
+	}
+	close(out_fd);
+	if (prepare() != 0)
+		_exit(1);
+	process_arglist(count, arglist);
+	finalize();
+	fflush(stdout);
+	fflush(stderr);
+	// _exit: exit() would rewind the script offset shared with the parent
+	_exit(shell_status());
+}
+
+
+// output of a finished line, in script order
+static void flush_output(batch_cmd* cmd)
+{
+	off_t off = 0;
+	off_t size = lseek(cmd->out_fd, 0, SEEK_END);
+
+	fflush(stdout);
+	while (off < size) {
+		ssize_t n = sendfile(1, cmd->out_fd, &off, size - off);
+		if (n == -1 && errno == EINVAL) {
+			// stdout opened with O_APPEND or a tty: copy through a buffer instead
+			char buf[65536];
+			n = pread(cmd->out_fd, buf, sizeof(buf), off);
+			if (n > 0 && (n = write(1, buf, n)) > 0)
+				off += n;
+		}
+		if (n <= 0) {
+			fprintf(stderr, "writing output failed: %s\n", strerror(errno));
+			break;
+		}
+	}
+	close(cmd->out_fd);
+}
+
+
+// blocks until one worker exits and prints every output that is now next in line,
+// *failed is set once a line exits non-zero or is killed
+static void reap_batch(batch_cmd* cmds, int* head, int tail, int* running, const char* out_dir, int* failed)
+{
+	pid_t pid;
+	int status;
+
+	do {
+		pid = waitpid(-1, &status, 0);
+	} while (pid == -1 && errno == EINTR);
+	if (pid == -1) {
+		fprintf(stderr, "waitpid failed: %s\n", strerror(errno));
+		exit(1);
+	}
+	for (int i = *head; i < tail; i++) {
+		if (cmds[i % BATCH_WINDOW].pid == pid) {
+			cmds[i % BATCH_WINDOW].done = 1;
+			--*running;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				*failed = 1;
+			break;
+		}
+	}
+	while (*head < tail && cmds[*head % BATCH_WINDOW].done) {
+		if (out_dir == NULL)
+			flush_output(&cmds[*head % BATCH_WINDOW]);
+		++*head;
+	}
+}
+
+
+// shell -j N [-o dir] script: up to N lines of script run at once, each in its own copy of the shell.
+// Output is captured per line, into dir/<line>.out or, without -o, printed in script order.
+// RETURNS - 0 if every line exited with 0, BATCH_FAILED otherwise
+static int run_batch(FILE* script, int max_jobs, const char* out_dir)
+{
+	static batch_cmd cmds[BATCH_WINDOW];
+	line_arena arena = {NULL, 0, NULL, 0, NULL, 0, NULL, 0};
+	int head = 0, tail = 0, running = 0, lineno = 0, failed = 0;
+	int count;
+
+	if (prepare_batch() != 0)
+		exit(1);
+
+	while ((count = next_line(&arena, script, &lineno)) != 0) {
+		char path[4096];
+
+		// a free slot, and room to keep the output until its turn comes
+		while (running == max_jobs || tail - head == BATCH_WINDOW)
+			reap_batch(cmds, &head, tail, &running, out_dir, &failed);
+
+		batch_cmd* cmd = &cmds[tail % BATCH_WINDOW];
+		if (out_dir != NULL) {
+			snprintf(path, sizeof(path), "%s/%d.out", out_dir, lineno);
+			cmd->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		} else {
+			cmd->out_fd = memfd_create("batch-output", MFD_CLOEXEC);
+		}
+		if (cmd->out_fd == -1) {
+			fprintf(stderr, "output file for line %d failed: %s\n", lineno, strerror(errno));
+			exit(1);
+		}
+		fflush(stdout);
+		cmd->pid = fork();
+		if (cmd->pid == -1) {
+			fprintf(stderr, "fork failed: %s\n", strerror(errno));
+			exit(1);
+		}
+		if (cmd->pid == 0)
+			run_batch_line(script, count, arena.arglist, cmd->out_fd);
+		if (out_dir != NULL)
+			close(cmd->out_fd);
+		cmd->done = 0;
+		++tail;
+		++running;
+	}
+	free_arena(&arena);
+	while (head < tail)
+		reap_batch(cmds, &head, tail, &running, out_dir, &failed);
+	finalize_batch();
+	return failed ? BATCH_FAILED : 0;
+}
+
+
+int main(int argc, char** argv)
+{
+	FILE* input = stdin;
+	const char* out_dir = NULL;
+	int max_jobs = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:o:")) != -1) {
+		switch (opt) {
+		case 'j':
+			max_jobs = atoi(optarg);
+			break;
+		case 'o':
+			out_dir = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-j jobs [-o dir]] [script]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (optind < argc) {
+		input = fopen(argv[optind], "r");
+		if (input == NULL) {
+			fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+			exit(1);
+		}
+	}
+	if (max_jobs < 0 || (max_jobs == 0 && out_dir != NULL)) {
+		fprintf(stderr, "usage: %s [-j jobs [-o dir]] [script]\n", argv[0]);
+		exit(1);
+	}
+	if (max_jobs > 0)
+		return run_batch(input, max_jobs, out_dir);
+
+	if (prepare() != 0)
+		exit(1);
+
+	line_arena arena = {NULL, 0, NULL, 0, NULL, 0, NULL, 0};
+	int lineno = 0, count;
+
+	while ((count = next_line(&arena, input, &lineno)) != 0)
+	{
+		if (!process_arglist(count, arena.arglist))
+			break;
 	}
+	free_arena(&arena);
 
 	if (finalize() != 0)
 		exit(1);
@@ -4,12 +4,68 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 
 # include "message_slot.h"
 
+// message_reader -f path channel [channel ...]: prints every message written to the channels
+// from now on as "channel: message", until killed. One fd per channel, all in one epoll set,
+// poll on the device is readable once per write.
+void follow(char* path, char* channels[], int count) {
+    struct epoll_event ev, events[64];
+    char buffer[MESSAGE_LEN+1];
+    int epfd = epoll_create1(0);
+    if(epfd < 0) {
+        err("Error in epoll_create\n")
+    }
+    for (int i = 0; i < count; i++) {
+        int fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd < 0) {
+            err("Error in file opening\n")
+        }
+        if(ioctl(fd, IOCTL_MSG_SLOT_CHANNEL, atoi(channels[i])) < 0) {
+            err("Error in setting channel_id\n")
+        }
+        // the message already there is old news, mark it as read
+        read(fd, buffer, MESSAGE_LEN);
+        ev.events = EPOLLIN;
+        ev.data.u64 = ((unsigned long long)i << 32) | (unsigned int)fd;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            err("Error in epoll_ctl\n")
+        }
+    }
+    while (1) {
+        int n = epoll_wait(epfd, events, 64, -1);
+        if(n < 0) {
+            err("Error in epoll_wait\n")
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = (int)(events[i].data.u64 & 0xffffffff);
+            int len = read(fd, buffer, MESSAGE_LEN);
+            if(len < 0 && errno == EWOULDBLOCK) {
+                continue;
+            }
+            if(len < 0) {
+                err("Error in reading\n")
+            }
+            buffer[len] = '\0';
+            printf("%s: %s\n", channels[events[i].data.u64 >> 32], buffer);
+            fflush(stdout);
+        }
+    }
+}
+
+// message_reader path channel [channel ...]
+// more than one channel: each message comes in with a single IOCTL_MSG_SLOT_READ, one per line
+// reads block until a channel has a message, see follow for waiting on new ones
 int main(int argc, char* args[]) {
-    if(argc != 3) {
+    if(argc >= 4 && strcmp(args[1], "-f") == 0) {
+        follow(args[2], args + 3, argc - 3);
+    }
+    if(argc < 3) {
         err("Invalid number of arguments\n")
     }
     char* path = args[1];
@@ -21,6 +77,20 @@ int main(int argc, char* args[]) {
     if (fd < 0) {
         err("Error in file opening\n")
     }
+    if (argc > 3) {
+        for (int i = 2; i < argc; i++) {
+            struct msg_slot_xfer xfer = {atoi(args[i]), MESSAGE_LEN, buffer};
+            int len = ioctl(fd, IOCTL_MSG_SLOT_READ, &xfer);
+            if(len < 0) {
+                close(fd);
+                err("Error in reading\n")
+            }
+            buffer[len] = '\0';
+            printf("%s\n", buffer);
+        }
+        close(fd);
+        exit(0);
+    }
     if(ioctl(fd, IOCTL_MSG_SLOT_CHANNEL, channel_id) < 0) {
         close(fd);
         err("Error in setting channel_id\n")
@@ -9,8 +9,10 @@
 
 # include "message_slot.h"
 
+// message_sender path channel msg [channel msg ...]
+// more than one message: each goes out with a single IOCTL_MSG_SLOT_WRITE, whatever its channel
 int main(int argc, char* args[]) {
-    if (argc != 4) {
+    if (argc < 4 || argc % 2 != 0) {
         err("Invalid Number of arguments\n")
     }
     char* path = args[1];
@@ -21,6 +23,18 @@ int main(int argc, char* args[]) {
     if(fd < 0) {
         err("Error in opening file\n")
     }
+    if (argc > 4) {
+        for (int i = 2; i < argc; i += 2) {
+            struct msg_slot_xfer xfer = {atoi(args[i]), strlen(args[i + 1]), args[i + 1]};
+            if(ioctl(fd, IOCTL_MSG_SLOT_WRITE, &xfer) < 0) {
+                close(fd);
+                err("Error in writing msg\n")
+            }
+        }
+        printf("Closing fd\n");
+        close(fd);
+        exit(0);
+    }
     int set_id = ioctl(fd, IOCTL_MSG_SLOT_CHANNEL, channel_id);
     if(set_id < 0) {
         close(fd);
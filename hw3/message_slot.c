@@ -11,99 +11,103 @@
 #include<linux/fs.h>
 #include<linux/uaccess.h>
 #include<linux/string.h>
+#include<linux/xarray.h>
+#include<linux/mutex.h>
+#include<linux/seqlock.h>
+#include<linux/wait.h>
+#include<linux/poll.h>
 #include "message_slot.h"
+#define CREATE_TRACE_POINTS
+#include "message_slot_trace.h"
 MODULE_LICENSE("GPL");
 
 
 // =============== data structures ==========================
 
+// msg and msg_len change only under lock, readers retry instead of blocking the writer
 typedef struct node {
     ssize_t channel_id;
+    seqlock_t lock;
     char msg[MESSAGE_LEN];
     int msg_len;
-    struct node *next;
+    unsigned long generation;   // writes so far, poll compares it with what a file has read
+    wait_queue_head_t wait;     // blocking readers and pollers, woken by every write
 }channel;
 
+// private_data of an open file
+typedef struct file_state {
+    ssize_t channel_id;     // 0 until IOCTL_MSG_SLOT_CHANNEL
+    unsigned long seen;     // generation of the last message read through this file
+}File_state;
+
 typedef struct device {
     int minor;
-    channel* channels;
+    struct xarray channels; // channel id -> channel, allocated on the first write
+    struct mutex lock;      // held to add channels, lookups take no lock
 }Device;
 
 static Device devices[256]; // 256 minors
 
 // ===================== CHANNEL GET/SET =======================================
 
+static channel* get_Channel(Device* dev, ssize_t id) {
+    return xa_load(&dev->channels, id);
+}
+
 static channel* getOrCreate_Channel(Device* dev, ssize_t id) {
-    channel* head;
-    channel *prev;
-    head = dev->channels;
-    // in case of empty list
-    if(!head) {
-        printk("Device desn't have channels yet, creating new channel head: %lu \n", id);
-        head = kmalloc(sizeof(channel), GFP_KERNEL);
-        if(head == NULL) {
-            printk("Failed to allocate memory \n");
-            return NULL;
-        }
-        head->channel_id = id;
-        memset(head->msg, 0, sizeof(head->msg));
-        head->msg_len = 0;
-        head->next = NULL;
-        // assigning head of this device channel
-        dev->channels = head;
-        printk(KERN_INFO "Created new head channel %lu\n", id);
-        return head;
-    }
-
-    // list isn't empty
-    while(head) {
-        printk("curr channel id is %ld \n", head->channel_id);
-        if(head->channel_id == id) {
-            printk(KERN_INFO "found channel %lu \n", id);
-            return head;
-        }
-        prev = head;
-        head = head->next;
+    channel* ch;
+    int err;
+    ch = get_Channel(dev, id);
+    if(ch) {
+        return ch;
+    }
+    mutex_lock(&dev->lock);
+    // another writer may have created it while we waited
+    ch = get_Channel(dev, id);
+    if(ch) {
+        mutex_unlock(&dev->lock);
+        return ch;
     }
     // if not found, create new channel
-    head = kmalloc(sizeof(channel), GFP_KERNEL);
-    if(!head){
-        printk(KERN_WARNING "Failed to allocate memory\n");
+    ch = kmalloc(sizeof(channel), GFP_KERNEL);
+    if(!ch){
+        mutex_unlock(&dev->lock);
+        trace_msg_slot_channel_create(dev - devices, id, -ENOMEM);
         return NULL;
     }
-    head->channel_id = id;
-    head->msg_len = 0;
-    memset(head->msg, 0, sizeof(head->msg));
-    head->next = NULL;
-
-    // add new node to the list
-    prev->next = head;
-
-    printk(KERN_INFO "created new channel %lu\n", id);
-    return head;
+    ch->channel_id = id;
+    seqlock_init(&ch->lock);
+    init_waitqueue_head(&ch->wait);
+    ch->msg_len = 0;
+    ch->generation = 0;
+    memset(ch->msg, 0, sizeof(ch->msg));
+
+    // channels are only freed at module exit, so lock-free lookups never see a freed one
+    err = xa_insert(&dev->channels, id, ch, GFP_KERNEL);
+    mutex_unlock(&dev->lock);
+    trace_msg_slot_channel_create(dev - devices, id, err);
+    if(err != 0) {
+        kfree(ch);
+        return NULL;
+    }
+    return ch;
 
 }
 
 // ======================= MEMORY CLEANUP =========================================
 
-static void free_slot_mem(channel* head) {
-
-
-    channel *next;
-    if (head == NULL) {
-        return;
-    }
-    while(head != NULL) {
-        kfree(head->msg);
-        next = head->next;
-        kfree(head);
-        head = next;
+static void free_slot_mem(Device* dev) {
+    channel *ch;
+    unsigned long id;
+    xa_for_each(&dev->channels, id, ch) {
+        kfree(ch);
     }
+    xa_destroy(&dev->channels);
 }
 static void free_devices_mem(void) {
     int i;
     for(i = 0; i < 256;i++) {
-        free_slot_mem(devices[i].channels);
+        free_slot_mem(&devices[i]);
     }
 }
 
@@ -112,102 +116,188 @@ static void free_devices_mem(void) {
 static int device_open(struct inode* inode, struct file* file) {
     int minor;
     minor = iminor(inode);
-    printk(KERN_INFO "Invoking device_open for file: %p, with minor: %d\n", file, minor);
-
+    file->private_data = kzalloc(sizeof(File_state), GFP_KERNEL);
+    if(file->private_data == NULL) {
+        return -ENOMEM;
+    }
+    mutex_lock(&devices[minor].lock);
     if(devices[minor].minor < 0) {
-        printk(KERN_INFO "Creating msg slot for minor: %d\n", minor);
         devices[minor].minor = minor;
-        devices[minor].channels = NULL;
     }
+    mutex_unlock(&devices[minor].lock);
     return 0;
 }
 static int device_release(struct inode* inode, struct file* file) {
-
-    printk("Releasing open instance of file with minor: %d, and channel: %lu \n", iminor(inode), (ssize_t)file->private_data);
+    kfree(file->private_data);
     file->private_data = NULL;
     return 0;
 
 }
 
-static ssize_t device_write(struct file* file,
-                        const char __user* buffer,
-                        size_t length,
-                        loff_t* offset) {
-    int err, minor;
-    ssize_t channel_id;
+// write and read of one message, shared by write()/read() and the single-syscall ioctls
+static ssize_t slot_write(int minor, ssize_t channel_id, const char __user* buffer, size_t length) {
+    int err;
     channel* ch;
-    if(file->private_data == NULL) {
-        printk(KERN_WARNING "No channel set\n");
-        return -EINVAL;
-    }
+    char msg[MESSAGE_LEN];
     if(length == 0 || length > MESSAGE_LEN) {
-		printk("Provided length is invalid \n");
         return -EMSGSIZE;
     }
-    channel_id = (ssize_t)file->private_data;
-    minor = iminor(file->f_inode);
+    // copied before taking the lock, a page fault must not stall the channel's readers
+    err = copy_from_user(msg, buffer, length);
+    if(err != 0) {
+        return -EFAULT;
+    }
 
     // assuming minor size are in range since using chregister
-    printk("getting or creating node for channel id %lu \n", channel_id);
     ch = getOrCreate_Channel(&devices[minor], channel_id);
+    if(ch == NULL) {
+        return -ENOMEM;
+    }
 
+    write_seqlock(&ch->lock);
+    memcpy(ch->msg, msg, length);
+    ch->msg_len = length;
+    ch->generation++;
+    write_sequnlock(&ch->lock);
+    wake_up_interruptible_poll(&ch->wait, EPOLLIN | EPOLLRDNORM);
 
+    return length;
+}
 
-    printk(KERN_INFO "Invoking writing into device file with minor: %d, channel_id: %lu, the msg:: %s \n", minor, channel_id, buffer);
-    err = copy_from_user(ch->msg, buffer, length);
+// an empty channel blocks until its first write unless nonblock, seen (if not NULL) gets the
+// generation of the message read
+static ssize_t slot_read(int minor, ssize_t channel_id, char __user* buffer, size_t length,
+                        int nonblock, unsigned long* seen) {
+    int err, msg_len;
+    unsigned int seq;
+    unsigned long generation;
+    channel *ch;
+    char msg[MESSAGE_LEN];
+    // assuming minor size are in range since using chregister
+    if(nonblock) {
+        // checking if it has a msg, a channel never written to has no entry at all
+        ch = get_Channel(&devices[minor], channel_id);
+        if(ch == NULL) {
+            return -EWOULDBLOCK;
+        }
+    } else {
+        // waiting needs the channel's wait queue, even before anyone wrote to it
+        ch = getOrCreate_Channel(&devices[minor], channel_id);
+        if(ch == NULL) {
+            return -ENOMEM;
+        }
+        if(wait_event_interruptible(ch->wait, READ_ONCE(ch->msg_len) != 0)) {
+            return -ERESTARTSYS;
+        }
+    }
+    // snapshot of the message, taken again if a write overlapped it
+    do {
+        seq = read_seqbegin(&ch->lock);
+        msg_len = READ_ONCE(ch->msg_len);
+        generation = ch->generation;
+        memcpy(msg, ch->msg, msg_len);
+    } while(read_seqretry(&ch->lock, seq));
+
+    if(msg_len == 0) {
+        return -EWOULDBLOCK;
+    }
+    if(msg_len > length) {
+        return -ENOSPC;
+    }
+    err = copy_to_user(buffer, msg, msg_len);
     if(err != 0) {
-        printk(KERN_WARNING "Error in copying from user \n");
         return -EFAULT;
     }
-    ch->msg_len = length;
+    if(seen != NULL) {
+        WRITE_ONCE(*seen, generation);
+    }
+    return msg_len;
+}
 
-    return length;
+// logging is left to the tracepoints, so an operation costs nothing extra until they are enabled
+static ssize_t device_write(struct file* file,
+                        const char __user* buffer,
+                        size_t length,
+                        loff_t* offset) {
+    File_state* fs = file->private_data;
+    ssize_t ret = -EINVAL;
+    // no channel set is -EINVAL
+    if(fs->channel_id != 0) {
+        ret = slot_write(iminor(file->f_inode), fs->channel_id, buffer, length);
+    }
+    trace_msg_slot_write(iminor(file->f_inode), fs->channel_id, length, ret);
+    return ret;
 }
 
 static ssize_t device_read(struct file* file,
                         char __user* buffer,
                         size_t length,
                         loff_t* offset) {
-    int err, minor;
-    ssize_t channel_id;
-    channel *ch;
-    if(file->private_data == NULL) {
-        printk(KERN_WARNING "error, the file doesn't point to channel \n");
-        return -EINVAL;
+    File_state* fs = file->private_data;
+    ssize_t ret = -EINVAL;
+    if(fs->channel_id != 0) {
+        ret = slot_read(iminor(file->f_inode), fs->channel_id, buffer, length,
+                        file->f_flags & O_NONBLOCK, &fs->seen);
     }
-    channel_id = (ssize_t)file->private_data;
-    minor = iminor(file->f_inode);
-    // assuming minor size are in range since using chregister
-    printk("Reading from device with minor : %d, and channel_id %ld\n",minor, channel_id);
-    ch = getOrCreate_Channel(&devices[minor], channel_id);
-    // checking if it has a msg
-    if(ch->msg_len == 0) {
-        printk(KERN_WARNING "Error, no message exists on channel\n");
-        return -EWOULDBLOCK;
+    trace_msg_slot_read(iminor(file->f_inode), fs->channel_id, length, ret);
+    return ret;
+}
+
+// readable once the channel has a message this file has not read yet, so a follower woken
+// by epoll reads each write once instead of seeing the kept message as ready forever
+static __poll_t device_poll(struct file* file, poll_table* wait) {
+    File_state* fs = file->private_data;
+    channel* ch;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+    if(fs->channel_id == 0) {
+        return EPOLLERR;
     }
-    if(ch->msg_len > length) {
-		printk(KERN_WARNING "Provided buffer length is too small to contain the previous written message \n");
-        return -ENOSPC;
+    // channels live until module exit, a later IOCTL_MSG_SLOT_CHANNEL leaves at most a stale wakeup
+    ch = getOrCreate_Channel(&devices[iminor(file->f_inode)], fs->channel_id);
+    if(ch == NULL) {
+        return EPOLLERR;
     }
-    err = copy_to_user(buffer, ch->msg, ch->msg_len);
-    if(err != 0) {
-        printk(KERN_WARNING "error in copying\n");
-        return -EFAULT;
+    poll_wait(file, &ch->wait, wait);
+    if(READ_ONCE(ch->generation) != READ_ONCE(fs->seen)) {
+        mask |= EPOLLIN | EPOLLRDNORM;
     }
-    return ch->msg_len;
+    return mask;
 }
 
 static long device_ioctl(struct file* file,
     unsigned int ioctl_command_id,
     unsigned long ioctl_param) {
+    struct msg_slot_xfer xfer;
+    long ret = -EINVAL;
 
-    printk(KERN_INFO "device_ioctl called for minor: %d, passing channel: %lu \n", iminor(file->f_inode), ioctl_param);
-    if(ioctl_command_id != IOCTL_MSG_SLOT_CHANNEL || ioctl_param == 0) {
-        return -EINVAL;
+    if(ioctl_command_id == IOCTL_MSG_SLOT_WRITE || ioctl_command_id == IOCTL_MSG_SLOT_READ) {
+        // channel and message in one call, for senders that switch channels on every message
+        if(copy_from_user(&xfer, (void __user*)ioctl_param, sizeof(xfer)) != 0) {
+            return -EFAULT;
+        }
+        if(ioctl_command_id == IOCTL_MSG_SLOT_WRITE) {
+            if(xfer.channel != 0) {
+                ret = slot_write(iminor(file->f_inode), xfer.channel, (const char __user*)xfer.buf, xfer.len);
+            }
+            trace_msg_slot_write(iminor(file->f_inode), xfer.channel, xfer.len, ret);
+            return ret;
+        }
+        if(xfer.channel != 0) {
+            ret = slot_read(iminor(file->f_inode), xfer.channel, (char __user*)xfer.buf, xfer.len,
+                            file->f_flags & O_NONBLOCK, NULL);
+        }
+        trace_msg_slot_read(iminor(file->f_inode), xfer.channel, xfer.len, ret);
+        return ret;
     }
-    // setting file discriptor channel id
-    file->private_data = (void*)ioctl_param;
-    return 0;
+    if(ioctl_command_id == IOCTL_MSG_SLOT_CHANNEL && ioctl_param != 0) {
+        // setting file discriptor channel id
+        File_state* fs = file->private_data;
+        fs->channel_id = ioctl_param;
+        fs->seen = 0;
+        ret = 0;
+    }
+    trace_msg_slot_set_channel(iminor(file->f_inode), ioctl_param, ret);
+    return ret;
 }
 
 // ======================== DEVICE SETUP =============================
@@ -218,6 +308,7 @@ struct file_operations FOPS = {
     .open = device_open,
     .unlocked_ioctl = device_ioctl,
     .release = device_release,
+    .poll = device_poll,
 
 
 };
@@ -226,15 +317,17 @@ static int __init msg_slot_init(void) {
     int rc = -1;
     int i;
     printk(KERN_INFO "Initializing message slot module\n");
+    // ready before registration, an open can come in as soon as it succeeds
+    for (i = 0; i < 256; i++) {
+        devices[i].minor = -1;
+        xa_init(&devices[i].channels);
+        mutex_init(&devices[i].lock);
+    }
     rc = register_chrdev(MAJOR_NUM, DEVICE_FILE_NAME, &FOPS);
     if (rc < 0) {
         printk(KERN_ALERT "%s registration failed for %d\n", DEVICE_FILE_NAME, MAJOR_NUM);
         return rc;
     }
-    for (i = 0; i < 256; i++) {
-        devices[i].minor = -1;
-        devices[i].channels = NULL;
-    }
     printk(KERN_INFO "Registration is successful\n");
 
     return 0;
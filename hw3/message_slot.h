@@ -6,6 +6,18 @@
 #define MAJOR_NUM 235
 
 #define IOCTL_MSG_SLOT_CHANNEL _IOW(MAJOR_NUM, 0, unsigned int)
+// name used by ex3_tester
+#define MSG_SLOT_CHANNEL IOCTL_MSG_SLOT_CHANNEL
+
+// channel and message of one single-syscall transfer, the file's own channel is left as it is
+struct msg_slot_xfer {
+    unsigned int channel;
+    unsigned int len;   // write: length of the message, read: size of buf
+    char *buf;
+};
+// ioctl(fd, IOCTL_MSG_SLOT_WRITE, &xfer) returns like write, IOCTL_MSG_SLOT_READ like read
+#define IOCTL_MSG_SLOT_WRITE _IOW(MAJOR_NUM, 1, struct msg_slot_xfer)
+#define IOCTL_MSG_SLOT_READ _IOW(MAJOR_NUM, 2, struct msg_slot_xfer)
 # define MESSAGE_LEN 128
 # define DEVICE_FILE_NAME "msg_slot_dev_file"
 # define DEVICE_RANGE_NAME "msg_slot_dev"
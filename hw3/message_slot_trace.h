@@ -0,0 +1,82 @@
+// tracepoints of the message slot, off until enabled, e.g.
+// echo 1 > /sys/kernel/tracing/events/message_slot/enable && cat /sys/kernel/tracing/trace_pipe
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM message_slot
+
+#if !defined(MESSAGE_SLOT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define MESSAGE_SLOT_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// one read or write, ret as returned to the caller (length or -errno)
+DECLARE_EVENT_CLASS(msg_slot_transfer,
+    TP_PROTO(int minor, unsigned long channel, size_t len, long ret),
+    TP_ARGS(minor, channel, len, ret),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned long, channel)
+        __field(size_t, len)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->channel = channel;
+        __entry->len = len;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%d channel=%lu len=%zu ret=%ld",
+        __entry->minor, __entry->channel, __entry->len, __entry->ret)
+);
+
+DEFINE_EVENT(msg_slot_transfer, msg_slot_write,
+    TP_PROTO(int minor, unsigned long channel, size_t len, long ret),
+    TP_ARGS(minor, channel, len, ret)
+);
+
+DEFINE_EVENT(msg_slot_transfer, msg_slot_read,
+    TP_PROTO(int minor, unsigned long channel, size_t len, long ret),
+    TP_ARGS(minor, channel, len, ret)
+);
+
+// IOCTL_MSG_SLOT_CHANNEL
+TRACE_EVENT(msg_slot_set_channel,
+    TP_PROTO(int minor, unsigned long channel, long ret),
+    TP_ARGS(minor, channel, ret),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned long, channel)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->channel = channel;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%d channel=%lu ret=%ld", __entry->minor, __entry->channel, __entry->ret)
+);
+
+// channel allocated on first use: a write, a blocking read or a poll; ret is 0 or -ENOMEM
+TRACE_EVENT(msg_slot_channel_create,
+    TP_PROTO(int minor, unsigned long channel, int ret),
+    TP_ARGS(minor, channel, ret),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(unsigned long, channel)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->channel = channel;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%d channel=%lu ret=%d", __entry->minor, __entry->channel, __entry->ret)
+);
+
+#endif
+
+// the header is found next to message_slot.c, see CFLAGS_message_slot.o in the Makefile
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE message_slot_trace
+#include <trace/define_trace.h>